@@ -0,0 +1,9 @@
+/*
+ * libarm64bitmask: definitions of the tables declared by arm64_bitmask.h,
+ * all functions are inline in the header. The decode tables are generated
+ * by arm64_bitmask_gen at build time.
+ */
+#define ARM64_BITMASK_IMPLEMENTATION
+#include "arm64_bitmask.h"
+
+#include "arm64_bitmask_tables.h"
@@ -0,0 +1,1852 @@
+/*
+ * ARM64 bitmask immediate library: DecodeBitMasks() and its table,
+ * encoder, validity checks, MOV alias selection (MoveWidePreferred()),
+ * logical (immediate) and SVE bitmask immediate instruction decoders and
+ * constant materialization planning.
+ *
+ * Every function is static inline, so callers in other tools inline the
+ * decoders like the harness does, and nothing here needs stdio. Tables
+ * are the only shared state, they are defined by the one translation
+ * unit which includes this header with ARM64_BITMASK_IMPLEMENTATION
+ * defined, libarm64bitmask is built from such a unit (arm64_bitmask.c).
+ * The decode tables are const data, arm64_bitmask_gen computes them from
+ * the *_table_entry() functions below at build time.
+ */
+#ifndef ARM64_BITMASK_H
+#define ARM64_BITMASK_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#if defined(ARM64_BITMASK_IMPLEMENTATION)
+#define ARM64_BITMASK_DATA
+#else
+#define ARM64_BITMASK_DATA extern
+#endif
+
+static inline bool arm64_is_bit_set(uint64_t value, uint32_t bit) {
+  return ((value >> bit) & 0x1);
+}
+
+/*
+ * Returns the highest set bit of `value`, search performs from
+ * most significant bit. If highest set bit is not found, we return -1.
+ */
+static inline int arm64_highest_set_bit_loop(uint64_t value) {
+  for (int i = sizeof(uint64_t) * CHAR_BIT - 1; i >= 0; i--) {
+    if (arm64_is_bit_set(value, i))
+      return (i);
+  }
+
+  return (-1);
+}
+
+/*
+ * Creates a 64 bit value with a specified number of ones starting from lsb.
+ *
+ * Example:
+ * 	`length` = 7
+ * 	`result` = 0b1111111
+ */
+static inline uint64_t arm64_ones(uint32_t length) {
+  /* Shift by 64 is undefined, all-ones S of 64 bit element comes here */
+  if (length >= 64)
+    return (~0ULL);
+
+  return ((1ULL << length) - 1);
+}
+
+/* Replicates `value` bits `esize` times with a fixed size `bit_count`.
+ *
+ * Example:
+ * 	`value`  = 0b10010011, `esize` = 8, `bit_count` = 32
+ * 	`result` = 0b10010011_10010011_10010011_10010011
+ */
+static inline uint64_t arm64_replicate_loop(uint64_t value, uint32_t esize,
+                                            int bit_count) {
+  uint64_t result, set_bits;
+
+  result = value;
+
+  for (set_bits = esize; set_bits < (uint64_t)bit_count; set_bits += esize) {
+    value <<= esize;
+    result |= value;
+  }
+
+  return (result);
+}
+
+/*
+ * Performs circular shift to the right, shifts all bits of a binary number
+ * `value` by `shift_count`, the least significant bit is pushed out.
+ *
+ * Example:
+ * 	`value`  = 0b0001_1101_0110_1011, `shift_count` = 2, `width` = 16
+ *	`result` = 0b1100_0111_0101_1010
+ */
+static inline uint64_t arm64_ror_shift(uint64_t value, uint32_t shift_count,
+                                       uint32_t width) {
+  uint64_t result, right_shift, left_shift;
+
+  right_shift = shift_count;
+  /* Zero rotation of 64 bit element must not shift left by 64 */
+  left_shift = (width - shift_count) & (width - 1);
+  result = value >> right_shift;
+  result |= value << left_shift;
+
+  /*
+   * Ignores redundant bits that we can get in result after left shift
+   */
+  if (width < 64)
+    result &= arm64_ones(width);
+
+  return (result);
+}
+
+/*
+ * Kernel variants of the primitives above. The loop/shift versions are
+ * the reference, every variant must give the same result on the domain
+ * used by the decoder (see check_variants() of the harness). Registries
+ * are sorted from the fastest variant, the first one supported by the CPU
+ * is bound to arm64_highest_set_bit(), arm64_replicate() and arm64_ror()
+ * at load time.
+ */
+static inline int arm64_highest_set_bit_clz(uint64_t value) {
+  /* Same as flsl() - 1, which isn't available everywhere */
+  return (value == 0 ? -1 : 63 - __builtin_clzll(value));
+}
+
+/* immN:NOT(imms) is 7 bit, larger values fall back to clz */
+#define ARM64_HSB_LUT_2(x) x, x
+#define ARM64_HSB_LUT_4(x) ARM64_HSB_LUT_2(x), ARM64_HSB_LUT_2(x)
+#define ARM64_HSB_LUT_8(x) ARM64_HSB_LUT_4(x), ARM64_HSB_LUT_4(x)
+#define ARM64_HSB_LUT_16(x) ARM64_HSB_LUT_8(x), ARM64_HSB_LUT_8(x)
+#define ARM64_HSB_LUT_32(x) ARM64_HSB_LUT_16(x), ARM64_HSB_LUT_16(x)
+#define ARM64_HSB_LUT_64(x) ARM64_HSB_LUT_32(x), ARM64_HSB_LUT_32(x)
+
+static const int8_t arm64_highest_set_bit_lut[128] = {
+    -1,
+    0,
+    ARM64_HSB_LUT_2(1),
+    ARM64_HSB_LUT_4(2),
+    ARM64_HSB_LUT_8(3),
+    ARM64_HSB_LUT_16(4),
+    ARM64_HSB_LUT_32(5),
+    ARM64_HSB_LUT_64(6),
+};
+
+static inline int arm64_highest_set_bit_lut128(uint64_t value) {
+  if (value < 128)
+    return (arm64_highest_set_bit_lut[value]);
+
+  return (arm64_highest_set_bit_clz(value));
+}
+
+/*
+ * Multipliers with a one at the start of every element, indexed by
+ * log2(esize). Product never carries since `value` fits into the element.
+ */
+static const uint64_t arm64_replicate_multipliers[7] = {
+    0xffffffffffffffffULL, 0x5555555555555555ULL, 0x1111111111111111ULL,
+    0x0101010101010101ULL, 0x0001000100010001ULL, 0x0000000100000001ULL,
+    0x0000000000000001ULL,
+};
+
+static inline uint64_t arm64_replicate_multiply(uint64_t value, uint32_t esize,
+                                                int bit_count) {
+  uint64_t result;
+
+  result = value * arm64_replicate_multipliers[__builtin_ctz(esize)];
+  if (bit_count < 64)
+    result &= arm64_ones(bit_count);
+
+  return (result);
+}
+
+#if defined(__x86_64__)
+__attribute__((target("lzcnt"))) static inline int
+arm64_highest_set_bit_lzcnt(uint64_t value) {
+  /* lzcnt of zero is 64, so -1 comes out without a branch */
+  return (63 - (int)_lzcnt_u64(value));
+}
+
+/* Doubles replicated part on every step, shlx and bzhi instead of masks */
+__attribute__((target("bmi2"))) static inline uint64_t
+arm64_replicate_bmi2(uint64_t value, uint32_t esize, int bit_count) {
+  for (uint32_t size = esize; size < (uint32_t)bit_count; size *= 2)
+    value |= value << size;
+
+  return (_bzhi_u64(value, bit_count));
+}
+
+__attribute__((target("bmi2"))) static inline uint64_t
+arm64_ror_bmi2(uint64_t value, uint32_t shift_count, uint32_t width) {
+  uint64_t result;
+
+  result = value >> shift_count;
+  result |= value << ((width - shift_count) & (width - 1));
+
+  /* bzhi keeps the whole value for 64 bit width */
+  return (_bzhi_u64(result, width));
+}
+#endif
+
+enum arm64_isa {
+  ARM64_ISA_ANY = 0,
+  ARM64_ISA_LZCNT,
+  ARM64_ISA_BMI2,
+};
+
+typedef int (*arm64_highest_set_bit_fn)(uint64_t value);
+typedef uint64_t (*arm64_replicate_fn)(uint64_t value, uint32_t esize,
+                                       int bit_count);
+typedef uint64_t (*arm64_ror_fn)(uint64_t value, uint32_t shift_count,
+                                 uint32_t width);
+
+static const struct arm64_highest_set_bit_variant {
+  const char *name;
+  enum arm64_isa isa;
+  arm64_highest_set_bit_fn fn;
+} arm64_highest_set_bit_variants[] = {
+#if defined(__x86_64__)
+    {"lzcnt", ARM64_ISA_LZCNT, arm64_highest_set_bit_lzcnt},
+#endif
+    {"lut128", ARM64_ISA_ANY, arm64_highest_set_bit_lut128},
+    {"clz", ARM64_ISA_ANY, arm64_highest_set_bit_clz},
+    {"loop", ARM64_ISA_ANY, arm64_highest_set_bit_loop},
+};
+
+static const struct arm64_replicate_variant {
+  const char *name;
+  enum arm64_isa isa;
+  arm64_replicate_fn fn;
+} arm64_replicate_variants[] = {
+    {"multiply", ARM64_ISA_ANY, arm64_replicate_multiply},
+#if defined(__x86_64__)
+    {"bmi2", ARM64_ISA_BMI2, arm64_replicate_bmi2},
+#endif
+    {"loop", ARM64_ISA_ANY, arm64_replicate_loop},
+};
+
+static const struct arm64_ror_variant {
+  const char *name;
+  enum arm64_isa isa;
+  arm64_ror_fn fn;
+} arm64_ror_variants[] = {
+#if defined(__x86_64__)
+    {"bmi2", ARM64_ISA_BMI2, arm64_ror_bmi2},
+#endif
+    {"shift", ARM64_ISA_ANY, arm64_ror_shift},
+};
+
+#define ARM64_NITEMS(x) (sizeof(x) / sizeof((x)[0]))
+
+#if defined(__x86_64__) && defined(__ELF__)
+#define ARM64_VARIANTS_IFUNC 1
+
+/*
+ * Called from ifunc resolvers, before constructors are run.
+ */
+static inline bool arm64_isa_supported(enum arm64_isa isa) {
+  __builtin_cpu_init();
+
+  switch (isa) {
+  case ARM64_ISA_LZCNT:
+    return (__builtin_cpu_supports("lzcnt"));
+  case ARM64_ISA_BMI2:
+    return (__builtin_cpu_supports("bmi2"));
+  default:
+    return (true);
+  }
+}
+
+static arm64_highest_set_bit_fn arm64_highest_set_bit_resolve(void) {
+  for (size_t i = 0; i < ARM64_NITEMS(arm64_highest_set_bit_variants); i++) {
+    if (arm64_isa_supported(arm64_highest_set_bit_variants[i].isa))
+      return (arm64_highest_set_bit_variants[i].fn);
+  }
+
+  return (arm64_highest_set_bit_loop);
+}
+
+static arm64_replicate_fn arm64_replicate_resolve(void) {
+  for (size_t i = 0; i < ARM64_NITEMS(arm64_replicate_variants); i++) {
+    if (arm64_isa_supported(arm64_replicate_variants[i].isa))
+      return (arm64_replicate_variants[i].fn);
+  }
+
+  return (arm64_replicate_loop);
+}
+
+static arm64_ror_fn arm64_ror_resolve(void) {
+  for (size_t i = 0; i < ARM64_NITEMS(arm64_ror_variants); i++) {
+    if (arm64_isa_supported(arm64_ror_variants[i].isa))
+      return (arm64_ror_variants[i].fn);
+  }
+
+  return (arm64_ror_shift);
+}
+
+static int arm64_highest_set_bit(uint64_t value)
+    __attribute__((ifunc("arm64_highest_set_bit_resolve")));
+static uint64_t arm64_replicate(uint64_t value, uint32_t esize, int bit_count)
+    __attribute__((ifunc("arm64_replicate_resolve")));
+static uint64_t arm64_ror(uint64_t value, uint32_t shift_count,
+                          uint32_t width)
+    __attribute__((ifunc("arm64_ror_resolve")));
+#else
+/* No CPU specific variants, portable ones are inlined directly */
+#define arm64_highest_set_bit arm64_highest_set_bit_lut128
+#define arm64_replicate arm64_replicate_multiply
+#define arm64_ror arm64_ror_shift
+#endif
+
+/*
+ * Decode counters, built with -DARM64_BITMASK_STATS only. Every thread
+ * counts into its own block, which is pushed onto a global list on first
+ * use and never freed, so counting is a plain increment without locks.
+ * Blocks are only written by their thread; readers sum them with relaxed
+ * loads while threads may still be running.
+ */
+#if defined(ARM64_BITMASK_STATS)
+struct arm64_bitmask_stats {
+  uint64_t calls;
+  /* UNDEFINED: length < 1, all-ones S and N=1 for W registers */
+  uint64_t undefined_length;
+  uint64_t undefined_ones;
+  uint64_t undefined_n;
+  /* Defined encodings by log2(esize) and by rotation */
+  uint64_t esize[7];
+  uint64_t rotation[64];
+  uint64_t move_wide_calls;
+  uint64_t move_wide_preferred;
+  uint64_t mov_alias;
+  struct arm64_bitmask_stats *next;
+};
+
+ARM64_BITMASK_DATA struct arm64_bitmask_stats *arm64_stats_head;
+ARM64_BITMASK_DATA __thread struct arm64_bitmask_stats *arm64_stats_self;
+
+static inline struct arm64_bitmask_stats *arm64_stats_thread(void) {
+  struct arm64_bitmask_stats *stats, *head;
+
+  if (arm64_stats_self != NULL)
+    return (arm64_stats_self);
+
+  stats = calloc(1, sizeof(*stats));
+  if (stats == NULL)
+    abort();
+
+  head = __atomic_load_n(&arm64_stats_head, __ATOMIC_RELAXED);
+  do {
+    stats->next = head;
+  } while (!__atomic_compare_exchange_n(&arm64_stats_head, &head, stats, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  arm64_stats_self = stats;
+  return (stats);
+}
+
+static inline void arm64_stats_inc(uint64_t *counter) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+#define ARM64_STATS_INC(field)                                                 \
+  do {                                                                         \
+    arm64_stats_inc(&arm64_stats_thread()->field);                             \
+  } while (0)
+
+/*
+ * Sums blocks of all threads into `total`, returns number of threads.
+ */
+static inline int arm64_stats_collect(struct arm64_bitmask_stats *total) {
+  const uint64_t *src;
+  uint64_t *dst;
+  int threads = 0;
+
+  memset(total, 0, sizeof(*total));
+  for (struct arm64_bitmask_stats *stats =
+           __atomic_load_n(&arm64_stats_head, __ATOMIC_ACQUIRE);
+       stats != NULL; stats = stats->next) {
+    /* All fields up to `next` are counters */
+    src = (const uint64_t *)stats;
+    dst = (uint64_t *)total;
+    for (size_t i = 0; i < offsetof(struct arm64_bitmask_stats, next) /
+                               sizeof(uint64_t);
+         i++)
+      dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    threads++;
+  }
+
+  return (threads);
+}
+
+#else
+#define ARM64_STATS_INC(field)                                                 \
+  do {                                                                         \
+  } while (0)
+#endif
+
+/*
+ * Returns true if bitmask is decoded successfully.
+ * According to Arm64 documentation we must return UNDEFINED
+ * in case of invalid parameters, thus we use false as UNDEFINED
+ * and on high flow of codebase we must print undefined.
+ */
+static inline bool arm64_disasm_bit_masks(uint32_t n, uint32_t imms,
+                                          uint32_t immr, bool logical_imm,
+                                          uint64_t *wmask) {
+  uint64_t welem;
+  uint32_t levels, s, r;
+  int length, esize;
+
+  /*
+   * Finds the highest set bit of immN:NOT(imms).
+   * Total bit count of immN(1) and imms(6) is 7,
+   * thus we start from 6 index.
+   */
+  length = arm64_highest_set_bit((n << 6) | (~imms & 0x3F));
+  ARM64_STATS_INC(calls);
+
+  if (length < 1) {
+    ARM64_STATS_INC(undefined_length);
+    return (false);
+  }
+
+  levels = arm64_ones(length);
+
+  /*
+   * For logical immediates an all-ones value of S is reserved
+   * since it would generate a useless all-ones result (many times)
+   */
+  if (logical_imm && (imms & levels) == levels) {
+    ARM64_STATS_INC(undefined_ones);
+    return (false);
+  }
+
+  s = imms & levels;
+  r = immr & levels;
+  ARM64_STATS_INC(esize[length]);
+  ARM64_STATS_INC(rotation[r]);
+
+  esize = 1 << length;
+  welem = arm64_ones(s + 1);
+  *wmask = arm64_ror(welem, r, esize);
+  *wmask = arm64_replicate(*wmask, esize, sizeof(uint64_t) * CHAR_BIT);
+
+  return (true);
+}
+
+/*
+ * W register variant of arm64_disasm_bit_masks(). immN must be 0 since
+ * the element can't be wider than 32 bits, so the value is replicated in
+ * 32 bit arithmetic and never needs truncation.
+ */
+static inline bool arm64_disasm_bit_masks32(uint32_t n, uint32_t imms,
+                                            uint32_t immr, bool logical_imm,
+                                            uint32_t *wmask) {
+  uint32_t welem, levels, s, r;
+  int length, esize;
+
+  ARM64_STATS_INC(calls);
+  if (n != 0) {
+    ARM64_STATS_INC(undefined_n);
+    return (false);
+  }
+
+  /* Highest set bit of NOT(imms), immN is known to be 0 */
+  length = arm64_highest_set_bit(~imms & 0x3F);
+  if (length < 1) {
+    ARM64_STATS_INC(undefined_length);
+    return (false);
+  }
+
+  levels = arm64_ones(length);
+  if (logical_imm && (imms & levels) == levels) {
+    ARM64_STATS_INC(undefined_ones);
+    return (false);
+  }
+
+  s = imms & levels;
+  r = immr & levels;
+  ARM64_STATS_INC(esize[length]);
+  ARM64_STATS_INC(rotation[r]);
+
+  esize = 1 << length;
+  welem = arm64_ones(s + 1);
+  if (r != 0)
+    welem = ((welem >> r) | (welem << (esize - r))) & arm64_ones(esize);
+  /* Low halves of the 64 bit multipliers replicate to 32 bits */
+  *wmask = welem * (uint32_t)arm64_replicate_multipliers[length];
+
+  return (true);
+}
+
+/*
+ * DecodeBitMasks() with both of its results: `wmask` as returned by
+ * arm64_disasm_bit_masks() and `tmask`, the element with the low
+ * ((S - R) mod esize) + 1 bits set, replicated. Bitfield moves take the
+ * bits of the source under `tmask` and rotate them into place by `wmask`.
+ * W registers use the low halves of both, immN must be 0 for them.
+ */
+static inline bool arm64_disasm_bit_masks_tmask(uint32_t n, uint32_t imms,
+                                                uint32_t immr, bool logical_imm,
+                                                uint64_t *wmask,
+                                                uint64_t *tmask) {
+  uint64_t welem, telem;
+  uint32_t levels, s, r, d;
+  int length, esize;
+
+  length = arm64_highest_set_bit((n << 6) | (~imms & 0x3F));
+  ARM64_STATS_INC(calls);
+
+  if (length < 1) {
+    ARM64_STATS_INC(undefined_length);
+    return (false);
+  }
+
+  levels = arm64_ones(length);
+  if (logical_imm && (imms & levels) == levels) {
+    ARM64_STATS_INC(undefined_ones);
+    return (false);
+  }
+
+  s = imms & levels;
+  r = immr & levels;
+  d = (s - r) & levels;
+  ARM64_STATS_INC(esize[length]);
+  ARM64_STATS_INC(rotation[r]);
+
+  esize = 1 << length;
+  welem = arm64_ones(s + 1);
+  telem = arm64_ones(d + 1);
+  *wmask = arm64_replicate(arm64_ror(welem, r, esize), esize,
+                           sizeof(uint64_t) * CHAR_BIT);
+  *tmask = arm64_replicate(telem, esize, sizeof(uint64_t) * CHAR_BIT);
+
+  return (true);
+}
+
+/*
+ * Returns true if bitmask immediate would generate an immediate value that
+ * also could be represented by a single MOVZ, MOVN or MOV (wide immediate)
+ * instruction. Also, this function determines should we use
+ * MOV (bitmask immediate) alias or ORR (immediate).
+ *
+ * Example:
+ * 	  `sf` = 1, `immn` = 1, `imms` = 0b011100, `immr` = 0b000011
+ * 	   First of all, we define `width`, since `sf` is 1 `width` will be 64.
+ * 	   Next step is to combine `immn` and `imms` to check element size
+ * 	   on total immediate size. So, immN:imms(7 bit) = 0b1011100.
+ * 	   and immN:imms matches to 0b1xxxxxx pattern. We skip checks
+ * 	   "imms < 16", imms greater than 16 and `imms` is less than
+ * 	   `width` - 17, thus move wide is not preferred and immediate
+ * 	   value e000000003ffffff can be used for MOV (bitmask immediate)
+ * 	   if Rn register is 31.
+ */
+static inline bool arm64_move_wide_preferred(int sf, uint32_t immn,
+                                             uint32_t imms, uint32_t immr) {
+  int width;
+
+  width = sf == 1 ? 64 : 32;
+
+  /*
+   * Element size must equal total immediate size.
+   * - for 64 bit immN:imms == '0b1xxxxxx'
+   * - for 32 bit immN:imms == '0b00xxxxx'
+   * Since, we know that immN:imms is 7 bit and patterns only take into
+   * account msb bits, no need to make bit pattern and masks.
+   * Hence, we can check only certain bits.
+   */
+  if (sf == 1 && immn != 1)
+    return (false);
+  if (sf == 0 && (immn != 0 || arm64_is_bit_set(imms, 5)))
+    return (false);
+
+  /* For MOVZ, imms must contain no more than 16 ones */
+  if (imms < 16)
+    /* Ones must not span halfword boundary when rotated */
+    return ((-immr & 15) <= 15 - imms);
+
+  /*
+   * For MOVN, the element must contain no more than 16 zeros, that is
+   * imms >= width - 17. The run of width - 1 - imms zeros starts at bit
+   * imms + 1 - immr, it must not span halfword boundary either.
+   */
+  if ((int)imms >= width - 17)
+    return (((imms + 1 - immr) & 15) <= imms - (width - 17));
+
+  return (false);
+}
+
+/*
+ * Bitfield move class: sf:opc:100110:N:immr:imms:Rn:Rd, opc is SBFM, BFM
+ * or UBFM. immN must equal sf and W registers have 0 in bit 5 of immr and
+ * imms, so the element is always the whole register.
+ */
+#define ARM64_BITFIELD_MASK 0x1f800000
+#define ARM64_BITFIELD_VALUE 0x13000000
+
+enum arm64_bitfield_op {
+  ARM64_BITFIELD_SBFM = 0,
+  ARM64_BITFIELD_BFM = 1,
+  ARM64_BITFIELD_UBFM = 2,
+};
+
+/*
+ * Every defined bitfield move has a preferred alias, so NONE only marks
+ * UNDEFINED encodings in arm64_bitfield_alias_table.
+ */
+enum arm64_bitfield_alias {
+  ARM64_BITFIELD_ALIAS_NONE = 0,
+  ARM64_BITFIELD_ALIAS_ASR,
+  ARM64_BITFIELD_ALIAS_SBFIZ,
+  ARM64_BITFIELD_ALIAS_SBFX,
+  ARM64_BITFIELD_ALIAS_SXTB,
+  ARM64_BITFIELD_ALIAS_SXTH,
+  ARM64_BITFIELD_ALIAS_SXTW,
+  /*
+   * BFI with Rn == ZR, or BFXIL with Rn == ZR and immr 0 for #lsb 0.
+   * Picked by the decoder since it depends on Rn.
+   */
+  ARM64_BITFIELD_ALIAS_BFC,
+  ARM64_BITFIELD_ALIAS_BFI,
+  ARM64_BITFIELD_ALIAS_BFXIL,
+  ARM64_BITFIELD_ALIAS_LSL,
+  ARM64_BITFIELD_ALIAS_LSR,
+  ARM64_BITFIELD_ALIAS_UBFIZ,
+  ARM64_BITFIELD_ALIAS_UBFX,
+  ARM64_BITFIELD_ALIAS_UXTB,
+  ARM64_BITFIELD_ALIAS_UXTH,
+};
+
+/*
+ * BFXPreferred(): true if SBFM or UBFM is an extract (SBFX, UBFX) rather
+ * than ASR, LSR or a sign/zero extension. `uns` is set for UBFM.
+ */
+static inline bool arm64_bfx_preferred(int sf, int uns, uint32_t imms,
+                                       uint32_t immr) {
+  /* Must not match UBFIZ/SBFIZ alias */
+  if (imms < immr)
+    return (false);
+
+  /* Must not match LSR/ASR/LSL alias (imms == 31 or 63) */
+  if (imms == ((uint32_t)sf << 5 | 0x1F))
+    return (false);
+
+  /* Must not match UXTx/SXTx alias */
+  if (immr == 0) {
+    /* Must not match 32 bit UXT[BH] or SXT[BH] */
+    if (sf == 0 && (imms == 7 || imms == 15))
+      return (false);
+    /* Must not match 64 bit SXT[BHW] */
+    if (sf == 1 && uns == 0 && (imms == 7 || imms == 15 || imms == 31))
+      return (false);
+  }
+
+  /* Must be UBFX/SBFX alias */
+  return (true);
+}
+
+/*
+ * Preferred alias of a defined bitfield move, in the order of the alias
+ * conditions of SBFM, BFM and UBFM. BFI and BFXIL are returned for BFC.
+ * The decoder reads it from arm64_bitfield_alias_table instead.
+ */
+static inline enum arm64_bitfield_alias
+arm64_bitfield_alias(int sf, uint32_t opc, uint32_t imms, uint32_t immr) {
+  uint32_t last;
+
+  last = (uint32_t)sf << 5 | 0x1F;
+  switch (opc) {
+  case ARM64_BITFIELD_SBFM:
+    if (imms == last)
+      return (ARM64_BITFIELD_ALIAS_ASR);
+    if (imms < immr)
+      return (ARM64_BITFIELD_ALIAS_SBFIZ);
+    if (arm64_bfx_preferred(sf, 0, imms, immr))
+      return (ARM64_BITFIELD_ALIAS_SBFX);
+    if (imms == 7)
+      return (ARM64_BITFIELD_ALIAS_SXTB);
+    if (imms == 15)
+      return (ARM64_BITFIELD_ALIAS_SXTH);
+    return (ARM64_BITFIELD_ALIAS_SXTW);
+  case ARM64_BITFIELD_BFM:
+    if (imms < immr)
+      return (ARM64_BITFIELD_ALIAS_BFI);
+    return (ARM64_BITFIELD_ALIAS_BFXIL);
+  default:
+    if (imms != last && imms + 1 == immr)
+      return (ARM64_BITFIELD_ALIAS_LSL);
+    if (imms == last)
+      return (ARM64_BITFIELD_ALIAS_LSR);
+    if (imms < immr)
+      return (ARM64_BITFIELD_ALIAS_UBFIZ);
+    if (arm64_bfx_preferred(sf, 1, imms, immr))
+      return (ARM64_BITFIELD_ALIAS_UBFX);
+    if (imms == 7)
+      return (ARM64_BITFIELD_ALIAS_UXTB);
+    return (ARM64_BITFIELD_ALIAS_UXTH);
+  }
+}
+
+/*
+ * arm64_move_wide_preferred() over every sf:immN:immr:imms, one bit per
+ * encoding. It is decided once per ORR with ZR in disassembly, the 2 KiB
+ * bitset keeps that to a load and a shift.
+ */
+#define ARM64_MOVE_WIDE_TABLE_BITS (1 << 14)
+
+extern const uint64_t arm64_move_wide_table[ARM64_MOVE_WIDE_TABLE_BITS / 64];
+
+/*
+ * The whole input space of arm64_disasm_bit_masks() is immN:immr:imms,
+ * 13 bits, so every decoded value fits into an 8192 entry table indexed
+ * exactly like bits [22:10] of a logical (immediate) instruction.
+ *
+ * Entries with undefined element size (length < 1) are stored as 0, this
+ * value can't be produced by a valid encoding. The reserved all-ones S
+ * always decodes to all-ones wmask, so for logical immediates the
+ * validity is `wmask != 0 && wmask != ~0`, no separate flag table needed.
+ */
+#define ARM64_BIT_MASKS_TABLE_SIZE (1 << 13)
+
+extern const uint64_t arm64_bit_masks_table[ARM64_BIT_MASKS_TABLE_SIZE];
+
+/*
+ * Preferred alias of every sf:opc:immr:imms, NONE for opc 11 and for W
+ * registers with bit 5 of immr or imms set. immN is left out of the index,
+ * the decoder compares it with sf. 32 KiB, one load per instruction.
+ */
+#define ARM64_BITFIELD_TABLE_SIZE (1 << 15)
+
+extern const uint8_t arm64_bitfield_alias_table[ARM64_BITFIELD_TABLE_SIZE];
+
+/* sf:opc:immr:imms, that is bits [31:29] and [21:10] of the instruction */
+static inline uint32_t arm64_bitfield_index(uint32_t sf, uint32_t opc,
+                                            uint32_t imms, uint32_t immr) {
+  return (((sf & 0x1) << 14) | ((opc & 0x3) << 12) | ((immr & 0x3F) << 6) |
+          (imms & 0x3F));
+}
+
+/* W registers have immN = 0, so their table is indexed by immr:imms only */
+#define ARM64_BIT_MASKS32_TABLE_SIZE (1 << 12)
+
+extern const uint32_t arm64_bit_masks32_table[ARM64_BIT_MASKS32_TABLE_SIZE];
+
+static inline uint32_t arm64_bit_masks_index(uint32_t n, uint32_t imms,
+                                             uint32_t immr) {
+  return (((n & 0x1) << 12) | ((immr & 0x3F) << 6) | (imms & 0x3F));
+}
+
+/*
+ * Entries of the decode tables, called only by arm64_bitmask_gen when it
+ * writes the tables out as initialized data.
+ */
+static inline uint64_t arm64_bit_masks_table_entry(uint32_t i) {
+  uint64_t wmask;
+
+  if (!arm64_disasm_bit_masks(i >> 12, i & 0x3F, (i >> 6) & 0x3F, false,
+                              &wmask))
+    return (0);
+
+  return (wmask);
+}
+
+static inline uint32_t arm64_bit_masks32_table_entry(uint32_t i) {
+  uint32_t wmask32;
+
+  if (!arm64_disasm_bit_masks32(0, i & 0x3F, (i >> 6) & 0x3F, false,
+                                &wmask32))
+    return (0);
+
+  return (wmask32);
+}
+
+/* UNDEFINED logical immediates stay 0, MOV alias doesn't apply to them */
+static inline uint64_t arm64_move_wide_table_word(uint32_t word) {
+  uint32_t n, immr, imms, i, wmask32;
+  uint64_t bits, wmask;
+
+  bits = 0;
+  for (i = word * 64; i < (word + 1) * 64; i++) {
+    n = (i >> 12) & 0x1;
+    immr = (i >> 6) & 0x3F;
+    imms = i & 0x3F;
+    if ((i >> 13) == 1 ? !arm64_disasm_bit_masks(n, imms, immr, true, &wmask)
+                       : !arm64_disasm_bit_masks32(n, imms, immr, true,
+                                                   &wmask32))
+      continue;
+    if (arm64_move_wide_preferred(i >> 13, n, imms, immr))
+      bits |= 1ULL << (i % 64);
+  }
+
+  return (bits);
+}
+
+static inline uint8_t arm64_bitfield_alias_table_entry(uint32_t i) {
+  uint32_t sf, opc, immr, imms;
+
+  sf = i >> 14;
+  opc = (i >> 12) & 0x3;
+  immr = (i >> 6) & 0x3F;
+  imms = i & 0x3F;
+  if (opc == 3 || (sf == 0 && ((immr | imms) & 0x20) != 0))
+    return (ARM64_BITFIELD_ALIAS_NONE);
+
+  return (arm64_bitfield_alias(sf, opc, imms, immr));
+}
+
+/*
+ * Table variant of arm64_disasm_bit_masks().
+ */
+static inline bool arm64_disasm_bit_masks_table(uint32_t n, uint32_t imms,
+                                                uint32_t immr, bool logical_imm,
+                                                uint64_t *wmask) {
+  uint64_t value;
+
+  value = arm64_bit_masks_table[arm64_bit_masks_index(n, imms, immr)];
+  if (value == 0 || (logical_imm && value == ~0ULL))
+    return (false);
+
+  *wmask = value;
+  return (true);
+}
+
+/*
+ * Table variant of arm64_disasm_bit_masks32(), same validity rules with
+ * 32 bit all-ones.
+ */
+static inline bool arm64_disasm_bit_masks32_table(uint32_t n, uint32_t imms,
+                                                  uint32_t immr,
+                                                  bool logical_imm,
+                                                  uint32_t *wmask) {
+  uint32_t value;
+
+  if (n != 0)
+    return (false);
+
+  value = arm64_bit_masks32_table[arm64_bit_masks_index(0, imms, immr)];
+  if (value == 0 || (logical_imm && value == UINT32_MAX))
+    return (false);
+
+  *wmask = value;
+  return (true);
+}
+
+/* sf:immN:immr:imms, sf is bit 31 of the instruction word */
+static inline uint32_t arm64_move_wide_index(uint32_t sf, uint32_t n,
+                                             uint32_t imms, uint32_t immr) {
+  return (((sf & 0x1) << 13) | arm64_bit_masks_index(n, imms, immr));
+}
+
+/*
+ * Table variant of arm64_move_wide_preferred().
+ */
+static inline bool arm64_move_wide_preferred_table(int sf, uint32_t immn,
+                                                   uint32_t imms,
+                                                   uint32_t immr) {
+  uint32_t index;
+  bool preferred;
+
+  index = arm64_move_wide_index(sf, immn, imms, immr);
+  preferred = (arm64_move_wide_table[index / 64] >> (index % 64)) & 0x1;
+  ARM64_STATS_INC(move_wide_calls);
+  if (preferred)
+    ARM64_STATS_INC(move_wide_preferred);
+
+  return (preferred);
+}
+
+/*
+ * immN:immr:imms occupy bits [22:10] of logical (immediate) instructions,
+ * so the table index is extracted from the instruction word by one shift.
+ */
+#define ARM64_INSN_BIT_MASKS_SHIFT 10
+
+static inline uint32_t arm64_insn_bit_masks_index(uint32_t insn) {
+  return ((insn >> ARM64_INSN_BIT_MASKS_SHIFT) &
+          (ARM64_BIT_MASKS_TABLE_SIZE - 1));
+}
+
+typedef void (*arm64_bit_masks_batch_fn)(const uint32_t *insns, size_t n,
+                                         uint64_t *wmask, uint8_t *valid);
+
+/*
+ * W register words (sf = 0) with N = 1 are UNDEFINED, for the others the
+ * low 32 bits of the replicated 64 bit value are the immediate.
+ */
+static inline void
+arm64_disasm_bit_masks_batch_scalar(const uint32_t *insns, size_t n,
+                                    uint64_t *wmask, uint8_t *valid) {
+  uint64_t value;
+  uint32_t sf;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    sf = insns[i] >> 31;
+    value = arm64_bit_masks_table[arm64_insn_bit_masks_index(insns[i])];
+    valid[i] = value != 0 && value != ~0ULL &&
+               (sf == 1 || ((insns[i] >> 22) & 0x1) == 0);
+    if (sf == 0)
+      value = (uint32_t)value;
+    wmask[i] = valid[i] ? value : 0;
+  }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2"))) static inline void
+arm64_disasm_bit_masks_batch_avx2(const uint32_t *insns, size_t n,
+                                  uint64_t *wmask, uint8_t *valid) {
+  const __m128i index_mask = _mm_set1_epi32(ARM64_BIT_MASKS_TABLE_SIZE - 1);
+  const __m256i zeros = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi64x(-1);
+  const __m256i low32 = _mm256_set1_epi64x(0xFFFFFFFF);
+  __m256i value, undefined, sf, n_bit;
+  __m128i words, index;
+  size_t i;
+  int bits;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    words = _mm_loadu_si128((const __m128i *)(insns + i));
+    index = _mm_and_si128(_mm_srli_epi32(words, ARM64_INSN_BIT_MASKS_SHIFT),
+                          index_mask);
+    value = _mm256_i32gather_epi64((const long long *)arm64_bit_masks_table,
+                                   index, sizeof(uint64_t));
+
+    /* sf (bit 31) and N (bit 22) as sign bits, widened to 64 bit lanes */
+    sf = _mm256_cmpgt_epi64(zeros, _mm256_cvtepi32_epi64(words));
+    n_bit = _mm256_cmpgt_epi64(
+        zeros, _mm256_cvtepi32_epi64(_mm_slli_epi32(words, 9)));
+
+    /* Same rule as scalar: 0 is undefined, all-ones is reserved S */
+    undefined = _mm256_or_si256(_mm256_cmpeq_epi64(value, zeros),
+                                _mm256_cmpeq_epi64(value, ones));
+    undefined = _mm256_or_si256(undefined, _mm256_andnot_si256(sf, n_bit));
+    value = _mm256_and_si256(value, _mm256_or_si256(sf, low32));
+    value = _mm256_andnot_si256(undefined, value);
+    _mm256_storeu_si256((__m256i *)(wmask + i), value);
+
+    bits = _mm256_movemask_pd(_mm256_castsi256_pd(undefined));
+    for (int j = 0; j < 4; j++)
+      valid[i + j] = !((bits >> j) & 0x1);
+  }
+
+  arm64_disasm_bit_masks_batch_scalar(insns + i, n - i, wmask + i, valid + i);
+}
+
+__attribute__((target("avx512f"))) static inline void
+arm64_disasm_bit_masks_batch_avx512(const uint32_t *insns, size_t n,
+                                    uint64_t *wmask, uint8_t *valid) {
+  const __m256i index_mask = _mm256_set1_epi32(ARM64_BIT_MASKS_TABLE_SIZE - 1);
+  const __m512i zeros = _mm512_setzero_si512();
+  const __m512i ones = _mm512_set1_epi64(-1);
+  const __m512i low32 = _mm512_set1_epi64(0xFFFFFFFF);
+  __m512i value;
+  __m256i words, index;
+  __mmask8 defined, sf, n_bit;
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    words = _mm256_loadu_si256((const __m256i *)(insns + i));
+    index = _mm256_and_si256(
+        _mm256_srli_epi32(words, ARM64_INSN_BIT_MASKS_SHIFT), index_mask);
+    value = _mm512_i32gather_epi64(index, arm64_bit_masks_table,
+                                   sizeof(uint64_t));
+
+    /* sf (bit 31) and N (bit 22) as sign bits, widened to 64 bit lanes */
+    sf = _mm512_cmplt_epi64_mask(_mm512_cvtepi32_epi64(words), zeros);
+    n_bit = _mm512_cmplt_epi64_mask(
+        _mm512_cvtepi32_epi64(_mm256_slli_epi32(words, 9)), zeros);
+    defined = _mm512_cmpneq_epi64_mask(value, zeros) &
+              _mm512_cmpneq_epi64_mask(value, ones) & (sf | ~n_bit);
+    value = _mm512_mask_and_epi64(value, (__mmask8)~sf, value, low32);
+    _mm512_storeu_si512(wmask + i, _mm512_maskz_mov_epi64(defined, value));
+
+    for (int j = 0; j < 8; j++)
+      valid[i + j] = (defined >> j) & 0x1;
+  }
+
+  arm64_disasm_bit_masks_batch_scalar(insns + i, n - i, wmask + i, valid + i);
+}
+#endif
+
+static inline arm64_bit_masks_batch_fn
+arm64_disasm_bit_masks_batch_kernel(void) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return (arm64_disasm_bit_masks_batch_avx512);
+  if (__builtin_cpu_supports("avx2"))
+    return (arm64_disasm_bit_masks_batch_avx2);
+#endif
+
+  return (arm64_disasm_bit_masks_batch_scalar);
+}
+
+/*
+ * Decodes logical immediates of `n` raw instruction words at once, for
+ * every word stores the bitmask into `wmask` and 1 into `valid` if it is
+ * defined, otherwise 0 into both.
+ */
+#if defined(ARM64_VARIANTS_IFUNC)
+static void arm64_disasm_bit_masks_batch(const uint32_t *insns, size_t n,
+                                         uint64_t *wmask, uint8_t *valid)
+    __attribute__((ifunc("arm64_disasm_bit_masks_batch_kernel")));
+#else
+static inline void arm64_disasm_bit_masks_batch(const uint32_t *insns,
+                                                size_t n, uint64_t *wmask,
+                                                uint8_t *valid) {
+  static arm64_bit_masks_batch_fn kernel;
+  arm64_bit_masks_batch_fn fn;
+
+  /* Threads racing on first use resolve the same kernel */
+  fn = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+  if (fn == NULL) {
+    fn = arm64_disasm_bit_masks_batch_kernel();
+    __atomic_store_n(&kernel, fn, __ATOMIC_RELAXED);
+  }
+
+  fn(insns, n, wmask, valid);
+}
+#endif
+
+/*
+ * Classifies `n` logical (immediate) instruction words at once, stores 1
+ * into `out` if MOVZ or MOVN is preferred over MOV (bitmask immediate)
+ * for the sf and immediate of the word, otherwise 0. Only sf and
+ * N:immr:imms are looked at, UNDEFINED encodings give 0.
+ */
+static inline void arm64_move_wide_preferred_batch(const uint32_t *insns,
+                                                   size_t n, uint8_t *out) {
+  uint32_t index;
+
+  for (size_t i = 0; i < n; i++) {
+    index = ((insns[i] >> 31) << 13) | arm64_insn_bit_masks_index(insns[i]);
+    out[i] = (arm64_move_wide_table[index / 64] >> (index % 64)) & 0x1;
+  }
+}
+
+/*
+ * Returns true if `value` is a non-empty contiguous run of ones,
+ * possibly shifted left, e.g. 0b0011_1000.
+ */
+static inline bool arm64_is_shifted_mask(uint64_t value) {
+  uint64_t filled;
+
+  /* Fill trailing zeros, a shifted mask becomes a mask from lsb */
+  filled = value | (value - 1);
+
+  return (value != 0 && ((filled + 1) & filled) == 0);
+}
+
+/*
+ * Inverse of arm64_disasm_bit_masks() for logical immediates, returns true
+ * and stores canonical `n`, `immr` and `imms` if `value` is encodable.
+ *
+ * Example:
+ * 	`value` = 0xe000000003ffffff
+ * 	 The smallest replicated element is the whole 64 bit value, ones
+ * 	 wrap around the element, so zeros run is 0x1ffffffffc000000.
+ * 	 Ones start at bit 61 and there are 29 of them, thus
+ * 	`n` = 1, `immr` = 0b000011, `imms` = 0b011100
+ */
+static inline bool arm64_encode_bit_masks_width(uint64_t value,
+                                                uint32_t width, uint32_t *n,
+                                                uint32_t *immr,
+                                                uint32_t *imms) {
+  uint64_t elem, mask;
+  uint32_t esize, half, ones, start;
+
+  /* Neither all-zeros nor all-ones could be produced by decoder */
+  if (value == 0 || value == arm64_ones(width))
+    return (false);
+
+  /* Finds the smallest element size which replicates to `value` */
+  for (esize = width; esize > 2; esize = half) {
+    half = esize / 2;
+    if (((value ^ (value >> half)) & arm64_ones(half)) != 0)
+      break;
+  }
+
+  mask = arm64_ones(esize);
+  elem = value & mask;
+
+  if (arm64_is_shifted_mask(elem)) {
+    start = __builtin_ctzll(elem);
+    ones = __builtin_popcountll(elem);
+  } else {
+    /* Ones wrap around the element, so zeros must be contiguous */
+    elem = ~elem & mask;
+    if (!arm64_is_shifted_mask(elem))
+      return (false);
+    start = __builtin_ctzll(elem) + __builtin_popcountll(elem);
+    ones = esize - __builtin_popcountll(elem);
+  }
+
+  /*
+   * imms holds NOT(esize - 1) in bits above the element length,
+   * for 64 bit element this is immN instead.
+   */
+  *n = esize == 64;
+  *immr = (esize - start) & (esize - 1);
+  *imms = (~(esize * 2 - 1) & 0x3F) | (ones - 1);
+
+  return (true);
+}
+
+static inline bool arm64_encode_bit_masks(uint64_t value, uint32_t *n,
+                                          uint32_t *immr, uint32_t *imms) {
+  return (arm64_encode_bit_masks_width(value, 64, n, immr, imms));
+}
+
+/*
+ * W register variant of arm64_encode_bit_masks(), the search starts from
+ * 32 bit element and `n` is always 0.
+ */
+static inline bool arm64_encode_bit_masks32(uint32_t value, uint32_t *n,
+                                            uint32_t *immr, uint32_t *imms) {
+  return (arm64_encode_bit_masks_width(value, 32, n, immr, imms));
+}
+
+/*
+ * Returns true if `value` is a logical immediate of `width` (32 or 64)
+ * bit registers, bits above `width` must be clear.
+ */
+static inline bool arm64_is_bitmask_imm(uint64_t value, uint32_t width) {
+  uint32_t n, immr, imms;
+
+  if (width == 32 && value > UINT32_MAX)
+    return (false);
+
+  return (arm64_encode_bit_masks_width(value, width, &n, &immr, &imms));
+}
+
+/*
+ * Branch free form of arm64_is_bitmask_imm() shared by the batch kernels:
+ *
+ * 1. values with bit 0 set are inverted, so no run of ones wraps around
+ *    an element and all-ones becomes 0
+ * 2. the period is the smallest of 2, 4, 8, 16 and 32 bits the value is
+ *    equal to itself rotated by, otherwise 64
+ * 3. the element must be one contiguous run: adding its lowest set bit
+ *    carries out of the run and clears every one of it
+ *
+ * W register values are replicated to 64 bits first, upper bits set make
+ * them invalid.
+ */
+typedef void (*arm64_bitmask_imm_batch_fn)(const uint64_t *vals, size_t n,
+                                           uint8_t *out, int width);
+
+static inline bool arm64_is_bitmask_imm_scalar(uint64_t value, int width) {
+  uint64_t x, mask, elem;
+
+  if (width == 32) {
+    if (value > UINT32_MAX)
+      return (false);
+    value |= value << 32;
+  }
+
+  x = value ^ (0 - (value & 0x1));
+  mask = ~0ULL;
+  for (uint32_t p = 32; p >= 2; p /= 2) {
+    if (x == ((x >> p) | (x << (64 - p))))
+      mask = arm64_ones(p);
+  }
+
+  elem = x & mask;
+  return (elem != 0 && ((elem + (elem & (0 - elem))) & elem) == 0);
+}
+
+static inline void arm64_is_bitmask_imm_batch_scalar(const uint64_t *vals,
+                                                     size_t n, uint8_t *out,
+                                                     int width) {
+  for (size_t i = 0; i < n; i++)
+    out[i] = arm64_is_bitmask_imm_scalar(vals[i], width);
+}
+
+#if defined(__x86_64__)
+#define ARM64_ROR256(x, p)                                                     \
+  _mm256_or_si256(_mm256_srli_epi64(x, p), _mm256_slli_epi64(x, 64 - (p)))
+
+__attribute__((target("avx2"))) static inline void
+arm64_is_bitmask_imm_batch_avx2(const uint64_t *vals, size_t n, uint8_t *out,
+                                int width) {
+  const __m256i zeros = _mm256_setzero_si256();
+  const __m256i low32 = _mm256_set1_epi64x(0xffffffff);
+  __m256i x, mask, elem, run, valid, wide, swapped;
+  size_t i;
+  int bits;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    x = _mm256_loadu_si256((const __m256i *)(vals + i));
+    wide = zeros;
+    if (width == 32) {
+      wide = _mm256_cmpeq_epi64(_mm256_andnot_si256(low32, x), zeros);
+      wide = _mm256_xor_si256(wide, _mm256_set1_epi64x(-1));
+      x = _mm256_or_si256(_mm256_and_si256(x, low32),
+                          _mm256_slli_epi64(x, 32));
+    }
+
+    /* Invert if bit 0 is set: x ^ -(x & 1) */
+    x = _mm256_xor_si256(
+        x, _mm256_sub_epi64(zeros, _mm256_and_si256(x, _mm256_set1_epi64x(1))));
+
+    /* Smaller periods imply larger ones, later blends win */
+    mask = _mm256_set1_epi64x(-1);
+    swapped = _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+    mask = _mm256_blendv_epi8(mask, low32, _mm256_cmpeq_epi64(x, swapped));
+    mask = _mm256_blendv_epi8(mask, _mm256_set1_epi64x(0xffff),
+                              _mm256_cmpeq_epi64(x, ARM64_ROR256(x, 16)));
+    mask = _mm256_blendv_epi8(mask, _mm256_set1_epi64x(0xff),
+                              _mm256_cmpeq_epi64(x, ARM64_ROR256(x, 8)));
+    mask = _mm256_blendv_epi8(mask, _mm256_set1_epi64x(0xf),
+                              _mm256_cmpeq_epi64(x, ARM64_ROR256(x, 4)));
+    mask = _mm256_blendv_epi8(mask, _mm256_set1_epi64x(0x3),
+                              _mm256_cmpeq_epi64(x, ARM64_ROR256(x, 2)));
+
+    elem = _mm256_and_si256(x, mask);
+    run = _mm256_and_si256(elem, _mm256_sub_epi64(zeros, elem));
+    run = _mm256_and_si256(_mm256_add_epi64(elem, run), elem);
+    valid = _mm256_andnot_si256(_mm256_cmpeq_epi64(elem, zeros),
+                                _mm256_cmpeq_epi64(run, zeros));
+    valid = _mm256_andnot_si256(wide, valid);
+
+    bits = _mm256_movemask_pd(_mm256_castsi256_pd(valid));
+    for (int j = 0; j < 4; j++)
+      out[i + j] = (bits >> j) & 0x1;
+  }
+
+  arm64_is_bitmask_imm_batch_scalar(vals + i, n - i, out + i, width);
+}
+
+#undef ARM64_ROR256
+
+__attribute__((target("avx512f"))) static inline void
+arm64_is_bitmask_imm_batch_avx512(const uint64_t *vals, size_t n,
+                                  uint8_t *out, int width) {
+  const __m512i zeros = _mm512_setzero_si512();
+  const __m512i low32 = _mm512_set1_epi64(0xffffffff);
+  __m512i x, mask, elem, run;
+  __mmask8 valid, narrow;
+  size_t i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    x = _mm512_loadu_si512(vals + i);
+    narrow = 0xff;
+    if (width == 32) {
+      narrow = _mm512_testn_epi64_mask(x, _mm512_set1_epi64(~0xffffffffLL));
+      x = _mm512_or_si512(_mm512_and_si512(x, low32), _mm512_slli_epi64(x, 32));
+    }
+
+    x = _mm512_xor_si512(
+        x, _mm512_sub_epi64(zeros, _mm512_and_si512(x, _mm512_set1_epi64(1))));
+
+    mask = _mm512_set1_epi64(-1);
+    mask = _mm512_mask_mov_epi64(
+        mask, _mm512_cmpeq_epi64_mask(x, _mm512_ror_epi64(x, 32)), low32);
+    mask = _mm512_mask_mov_epi64(
+        mask, _mm512_cmpeq_epi64_mask(x, _mm512_ror_epi64(x, 16)),
+        _mm512_set1_epi64(0xffff));
+    mask = _mm512_mask_mov_epi64(
+        mask, _mm512_cmpeq_epi64_mask(x, _mm512_ror_epi64(x, 8)),
+        _mm512_set1_epi64(0xff));
+    mask = _mm512_mask_mov_epi64(
+        mask, _mm512_cmpeq_epi64_mask(x, _mm512_ror_epi64(x, 4)),
+        _mm512_set1_epi64(0xf));
+    mask = _mm512_mask_mov_epi64(
+        mask, _mm512_cmpeq_epi64_mask(x, _mm512_ror_epi64(x, 2)),
+        _mm512_set1_epi64(0x3));
+
+    elem = _mm512_and_si512(x, mask);
+    run = _mm512_and_si512(elem, _mm512_sub_epi64(zeros, elem));
+    run = _mm512_and_si512(_mm512_add_epi64(elem, run), elem);
+    valid = narrow & _mm512_test_epi64_mask(elem, elem) &
+            _mm512_testn_epi64_mask(run, run);
+
+    for (int j = 0; j < 8; j++)
+      out[i + j] = (valid >> j) & 0x1;
+  }
+
+  arm64_is_bitmask_imm_batch_scalar(vals + i, n - i, out + i, width);
+}
+#endif
+
+static inline arm64_bitmask_imm_batch_fn
+arm64_is_bitmask_imm_batch_kernel(void) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return (arm64_is_bitmask_imm_batch_avx512);
+  if (__builtin_cpu_supports("avx2"))
+    return (arm64_is_bitmask_imm_batch_avx2);
+#endif
+
+  return (arm64_is_bitmask_imm_batch_scalar);
+}
+
+/*
+ * Stores into `out` 1 for every value of `vals` which is a logical
+ * immediate of `width` (32 or 64) bit registers, otherwise 0. Needs no
+ * tables.
+ */
+#if defined(ARM64_VARIANTS_IFUNC)
+static void arm64_is_bitmask_imm_batch(const uint64_t *vals, size_t n,
+                                       uint8_t *out, int width)
+    __attribute__((ifunc("arm64_is_bitmask_imm_batch_kernel")));
+#else
+static inline void arm64_is_bitmask_imm_batch(const uint64_t *vals, size_t n,
+                                              uint8_t *out, int width) {
+  static arm64_bitmask_imm_batch_fn kernel;
+  arm64_bitmask_imm_batch_fn fn;
+
+  /* Threads racing on first use resolve the same kernel */
+  fn = __atomic_load_n(&kernel, __ATOMIC_RELAXED);
+  if (fn == NULL) {
+    fn = arm64_is_bitmask_imm_batch_kernel();
+    __atomic_store_n(&kernel, fn, __ATOMIC_RELAXED);
+  }
+
+  fn(vals, n, out, width);
+}
+#endif
+
+/*
+ * Logical (immediate) class: sf:opc:100100:N:immr:imms:Rn:Rd
+ */
+#define ARM64_LOGICAL_IMM_MASK 0x1f800000
+#define ARM64_LOGICAL_IMM_VALUE 0x12000000
+#define ARM64_REG_ZR 31
+
+enum arm64_logical_op {
+  ARM64_LOGICAL_AND = 0,
+  ARM64_LOGICAL_ORR = 1,
+  ARM64_LOGICAL_EOR = 2,
+  ARM64_LOGICAL_ANDS = 3,
+};
+
+enum arm64_logical_alias {
+  ARM64_LOGICAL_ALIAS_NONE = 0,
+  /* MOV (bitmask immediate), ORR with Rn == ZR */
+  ARM64_LOGICAL_ALIAS_MOV,
+  /* TST (immediate), ANDS with Rd == ZR */
+  ARM64_LOGICAL_ALIAS_TST,
+};
+
+struct arm64_logical_imm_insn {
+  uint64_t imm;
+  enum arm64_logical_op op;
+  enum arm64_logical_alias alias;
+  uint8_t sf;
+  uint8_t rd;
+  uint8_t rn;
+};
+
+/*
+ * Decodes AND, ORR, EOR and ANDS (immediate) instruction word into `out`,
+ * returns false if `insn` isn't a logical (immediate) instruction or
+ * it is UNDEFINED. The immediate is 32 bit wide for W registers.
+ */
+static inline bool
+arm64_disasm_logical_imm(uint32_t insn, struct arm64_logical_imm_insn *out) {
+  uint32_t n, immr, imms, imm32;
+  uint64_t imm;
+
+  if ((insn & ARM64_LOGICAL_IMM_MASK) != ARM64_LOGICAL_IMM_VALUE)
+    return (false);
+
+  out->sf = insn >> 31;
+  out->op = (insn >> 29) & 0x3;
+  out->rn = (insn >> 5) & 0x1F;
+  out->rd = insn & 0x1F;
+  n = (insn >> 22) & 0x1;
+  immr = (insn >> 16) & 0x3F;
+  imms = (insn >> 10) & 0x3F;
+
+  if (out->sf == 1) {
+    if (!arm64_disasm_bit_masks_table(n, imms, immr, true, &imm))
+      return (false);
+    out->imm = imm;
+  } else {
+    /* 64 bit element is reserved for W registers, table32 rejects it */
+    if (!arm64_disasm_bit_masks32_table(n, imms, immr, true, &imm32))
+      return (false);
+    out->imm = imm32;
+  }
+
+  out->alias = ARM64_LOGICAL_ALIAS_NONE;
+  if (out->op == ARM64_LOGICAL_ORR && out->rn == ARM64_REG_ZR &&
+      !arm64_move_wide_preferred_table(out->sf, n, imms, immr)) {
+    out->alias = ARM64_LOGICAL_ALIAS_MOV;
+    ARM64_STATS_INC(mov_alias);
+  } else if (out->op == ARM64_LOGICAL_ANDS && out->rd == ARM64_REG_ZR)
+    out->alias = ARM64_LOGICAL_ALIAS_TST;
+
+  return (true);
+}
+
+struct arm64_bitfield_insn {
+  /* DecodeBitMasks() results, 32 bit wide for W registers */
+  uint64_t wmask;
+  uint64_t tmask;
+  enum arm64_bitfield_op op;
+  enum arm64_bitfield_alias alias;
+  uint8_t sf;
+  uint8_t rd;
+  uint8_t rn;
+  uint8_t immr;
+  uint8_t imms;
+  /* #lsb and #width of the alias, shift of LSL, LSR and ASR is `lsb` */
+  uint8_t lsb;
+  uint8_t width;
+};
+
+static inline uint32_t arm64_insn_bitfield_index(uint32_t insn) {
+  return (((insn >> 17) & 0x7000) | ((insn >> 10) & 0xFFF));
+}
+
+/*
+ * Decodes SBFM, BFM and UBFM instruction word into `out`, returns false if
+ * `insn` isn't a bitfield move or it is UNDEFINED. The alias is a single
+ * load from arm64_bitfield_alias_table, which also rejects opc 11 and
+ * out of range W register fields, only BFC is told apart by Rn here.
+ */
+static inline bool arm64_disasm_bitfield(uint32_t insn,
+                                         struct arm64_bitfield_insn *out) {
+  uint32_t n, immr, imms, datasize;
+  uint8_t alias;
+
+  if ((insn & ARM64_BITFIELD_MASK) != ARM64_BITFIELD_VALUE)
+    return (false);
+
+  alias = arm64_bitfield_alias_table[arm64_insn_bitfield_index(insn)];
+  n = (insn >> 22) & 0x1;
+  if (alias == ARM64_BITFIELD_ALIAS_NONE || n != insn >> 31)
+    return (false);
+
+  out->sf = insn >> 31;
+  out->op = (insn >> 29) & 0x3;
+  out->rn = (insn >> 5) & 0x1F;
+  out->rd = insn & 0x1F;
+  out->immr = immr = (insn >> 16) & 0x3F;
+  out->imms = imms = (insn >> 10) & 0x3F;
+  out->alias = alias;
+  if (out->rn == ARM64_REG_ZR &&
+      (alias == ARM64_BITFIELD_ALIAS_BFI ||
+       (alias == ARM64_BITFIELD_ALIAS_BFXIL && immr == 0)))
+    out->alias = ARM64_BITFIELD_ALIAS_BFC;
+
+  /* The element is the register, so R and S are immr and imms as is */
+  datasize = out->sf ? 64 : 32;
+  if (out->sf == 1)
+    out->wmask = arm64_bit_masks_table[arm64_bit_masks_index(1, imms, immr)];
+  else
+    out->wmask = arm64_bit_masks32_table[arm64_bit_masks_index(0, imms, immr)];
+  out->tmask = arm64_ones(((imms - immr) & (datasize - 1)) + 1);
+
+  if (imms < immr) {
+    /* Insert: SBFIZ, BFI, BFC, UBFIZ and LSL */
+    out->lsb = (datasize - immr) & (datasize - 1);
+    out->width = imms + 1;
+  } else {
+    out->lsb = immr;
+    out->width = imms - immr + 1;
+  }
+
+  return (true);
+}
+
+/*
+ * SVE bitmask immediate class: 00000101:opc:0000:imm13:Zd, opc is ORR, EOR,
+ * AND (immediate) with Zdn or DUPM with Zd. imm13 is N:immr:imms, the
+ * same fields as bits [22:10] of logical (immediate) instructions.
+ */
+#define ARM64_SVE_BITMASK_IMM_MASK 0xff3c0000
+#define ARM64_SVE_BITMASK_IMM_VALUE 0x05000000
+#define ARM64_SVE_IMM13_SHIFT 5
+/* Vector length limits of SVE, in bits */
+#define ARM64_SVE_VL_MIN 128
+#define ARM64_SVE_VL_MAX 2048
+
+enum arm64_sve_bitmask_op {
+  ARM64_SVE_ORR = 0,
+  ARM64_SVE_EOR = 1,
+  ARM64_SVE_AND = 2,
+  ARM64_SVE_DUPM = 3,
+};
+
+enum arm64_sve_bitmask_alias {
+  ARM64_SVE_ALIAS_NONE = 0,
+  /* MOV (bitmask immediate), DUPM which DUP (immediate) can't express */
+  ARM64_SVE_ALIAS_MOV,
+};
+
+struct arm64_sve_bitmask_imm_insn {
+  /* Decoded immediate replicated to 64 bits */
+  uint64_t imm;
+  enum arm64_sve_bitmask_op op;
+  enum arm64_sve_bitmask_alias alias;
+  /* Element size <T> in bits: 8, 16, 32 or 64 */
+  uint8_t esize;
+  uint8_t zd;
+};
+
+/*
+ * Element size <T> selected by imm13: N=1 is D, imms 0xxxxx is S, 10xxxx
+ * is H and 110xxx, 1110xx, 11110x are B. It is the DecodeBitMasks()
+ * element size clamped to a byte, 0 is returned for the reserved 11111x.
+ */
+static inline uint32_t arm64_sve_bitmask_esize(uint32_t n, uint32_t imms) {
+  int length;
+
+  length = arm64_highest_set_bit((n << 6) | (~imms & 0x3F));
+  if (length < 1)
+    return (0);
+
+  return (length < 3 ? 8 : 1U << length);
+}
+
+/*
+ * Returns true if `esize` bit element of `imm` is a DUP (immediate)
+ * constant: sign extended imm8, optionally shifted left by 8 for
+ * elements wider than a byte.
+ */
+static inline bool arm64_sve_dup_imm_fits(uint64_t imm, uint32_t esize) {
+  int64_t elem;
+
+  elem = (int64_t)(imm << (64 - esize)) >> (64 - esize);
+  if (elem >= -128 && elem <= 127)
+    return (true);
+
+  return (esize > 8 && (elem & 0xFF) == 0 && elem >= -32768 && elem <= 32512);
+}
+
+/*
+ * SVEMoveMaskPreferred(): DUPM is disassembled as MOV unless the value is
+ * also a DUP (immediate) constant for some element size it replicates in.
+ */
+static inline bool arm64_sve_move_mask_preferred(uint64_t imm) {
+  uint32_t esize;
+
+  for (esize = 64; esize >= 8; esize /= 2) {
+    if (esize < 64 &&
+        imm != arm64_replicate(imm & arm64_ones(esize), esize, 64))
+      break;
+    if (arm64_sve_dup_imm_fits(imm, esize))
+      return (false);
+  }
+
+  return (true);
+}
+
+/*
+ * Decodes SVE AND, EOR, ORR (immediate) and DUPM instruction word into
+ * `out`, returns false if `insn` isn't one of them or imm13 is reserved.
+ * Only unpredicated forms of these instructions exist.
+ */
+static inline bool
+arm64_disasm_sve_bitmask_imm(uint32_t insn,
+                             struct arm64_sve_bitmask_imm_insn *out) {
+  uint32_t n, immr, imms;
+
+  if ((insn & ARM64_SVE_BITMASK_IMM_MASK) != ARM64_SVE_BITMASK_IMM_VALUE)
+    return (false);
+
+  n = (insn >> 17) & 0x1;
+  immr = (insn >> 11) & 0x3F;
+  imms = (insn >> 5) & 0x3F;
+  if (!arm64_disasm_bit_masks_table(n, imms, immr, true, &out->imm))
+    return (false);
+
+  out->op = (insn >> 22) & 0x3;
+  out->esize = arm64_sve_bitmask_esize(n, imms);
+  out->zd = insn & 0x1F;
+  out->alias = ARM64_SVE_ALIAS_NONE;
+  if (out->op == ARM64_SVE_DUPM && arm64_sve_move_mask_preferred(out->imm))
+    out->alias = ARM64_SVE_ALIAS_MOV;
+
+  return (true);
+}
+
+/*
+ * Encodes <op> Zd.<T>, #value. `value` is one `esize` bit element, it is
+ * replicated across 64 bits first, so the encoded <T> may be narrower
+ * when the element repeats itself. Returns false if it is not a bitmask
+ * immediate or doesn't fit the element.
+ */
+static inline bool arm64_asm_sve_bitmask_imm(enum arm64_sve_bitmask_op op,
+                                             uint32_t esize, uint64_t value,
+                                             uint32_t zd, uint32_t *insn) {
+  uint32_t n, immr, imms;
+
+  if (esize != 8 && esize != 16 && esize != 32 && esize != 64)
+    return (false);
+  if ((value & ~arm64_ones(esize)) != 0 || zd > 31)
+    return (false);
+
+  value = arm64_replicate(value, esize, 64);
+  if (!arm64_encode_bit_masks(value, &n, &immr, &imms))
+    return (false);
+
+  *insn = ARM64_SVE_BITMASK_IMM_VALUE | ((uint32_t)op << 22) |
+          (((n << 12) | (immr << 6) | imms) << ARM64_SVE_IMM13_SHIFT) | zd;
+
+  return (true);
+}
+
+/*
+ * Stores the decoded immediate across a `vl` bit Z register image in
+ * `buf`, `vl` is a multiple of 128 between 128 and 2048. Every element
+ * size repeats within 64 bits, so the value is splat into 128 bit lanes.
+ */
+static inline bool arm64_sve_bitmask_fill(uint64_t imm, uint32_t vl,
+                                          void *buf) {
+  uint8_t *p = buf;
+  uint32_t i;
+
+  if (vl < ARM64_SVE_VL_MIN || vl > ARM64_SVE_VL_MAX || vl % 128 != 0)
+    return (false);
+
+#if defined(__x86_64__)
+  const __m128i lane = _mm_set1_epi64x(imm);
+
+  for (i = 0; i < vl / 8; i += 16)
+    _mm_storeu_si128((__m128i *)(p + i), lane);
+#elif defined(__aarch64__)
+  const uint64x2_t lane = vdupq_n_u64(imm);
+
+  for (i = 0; i < vl / 8; i += 16)
+    vst1q_u8(p + i, vreinterpretq_u8_u64(lane));
+#else
+  for (i = 0; i < vl / 8; i += sizeof(imm))
+    memcpy(p + i, &imm, sizeof(imm));
+#endif
+
+  return (true);
+}
+
+/*
+ * Constant materialization for X registers. A plan is the sequence of
+ * instruction words building the constant in Rd. Its cost is the number
+ * of instructions; candidates of the same cost are tried in the order
+ * of arm64_plan_constant() and the first one wins.
+ */
+#define ARM64_MOVN_X 0x92800000
+#define ARM64_MOVZ_X 0xd2800000
+#define ARM64_MOVK_X 0xf2800000
+#define ARM64_PLAN_MAX_INSNS 4
+
+struct arm64_constant_plan {
+  uint32_t insns[ARM64_PLAN_MAX_INSNS];
+  uint32_t count;
+};
+
+static inline uint32_t arm64_halfword(uint64_t value, uint32_t hw) {
+  return ((value >> (hw * 16)) & 0xFFFF);
+}
+
+static inline void arm64_plan_move_wide(struct arm64_constant_plan *plan,
+                                        uint32_t base, uint32_t hw,
+                                        uint32_t imm16, uint32_t rd) {
+  plan->insns[plan->count++] = base | (hw << 21) | (imm16 << 5) | rd;
+}
+
+static inline void arm64_plan_logical(struct arm64_constant_plan *plan,
+                                      enum arm64_logical_op op, uint32_t n,
+                                      uint32_t immr, uint32_t imms,
+                                      uint32_t rn, uint32_t rd) {
+  plan->insns[plan->count++] = 0x92000000 | ((uint32_t)op << 29) |
+                               (n << 22) | (immr << 16) | (imms << 10) |
+                               (rn << 5) | rd;
+}
+
+/*
+ * MOVZ (or MOVN for `fill` 0xFFFF) of the first halfword differing from
+ * `fill`, then MOVK for every other one.
+ */
+static inline void
+arm64_plan_move_wide_chain(uint64_t value, uint32_t fill, uint32_t rd,
+                           struct arm64_constant_plan *plan) {
+  uint32_t hw, first, chunk;
+
+  for (first = 0; first < 3; first++) {
+    if (arm64_halfword(value, first) != fill)
+      break;
+  }
+
+  chunk = arm64_halfword(value, first);
+  if (fill == 0)
+    arm64_plan_move_wide(plan, ARM64_MOVZ_X, first, chunk, rd);
+  else
+    arm64_plan_move_wide(plan, ARM64_MOVN_X, first, ~chunk & 0xFFFF, rd);
+
+  for (hw = first + 1; hw < 4; hw++) {
+    chunk = arm64_halfword(value, hw);
+    if (chunk != fill)
+      arm64_plan_move_wide(plan, ARM64_MOVK_X, hw, chunk, rd);
+  }
+}
+
+/*
+ * ORR of `bitmask` followed by MOVK of the halfwords it gets wrong, if
+ * that fits into `max` instructions.
+ */
+static inline bool arm64_plan_orr_movk(uint64_t value, uint64_t bitmask,
+                                       uint32_t max, uint32_t rd,
+                                       struct arm64_constant_plan *plan) {
+  uint32_t n, immr, imms, hw, count;
+
+  count = 1;
+  for (hw = 0; hw < 4; hw++)
+    count += arm64_halfword(value ^ bitmask, hw) != 0;
+  if (count > max || !arm64_encode_bit_masks(bitmask, &n, &immr, &imms))
+    return (false);
+
+  arm64_plan_logical(plan, ARM64_LOGICAL_ORR, n, immr, imms, ARM64_REG_ZR,
+                     rd);
+  for (hw = 0; hw < 4; hw++) {
+    if (arm64_halfword(value ^ bitmask, hw) != 0)
+      arm64_plan_move_wide(plan, ARM64_MOVK_X, hw, arm64_halfword(value, hw),
+                           rd);
+  }
+
+  return (true);
+}
+
+/* Ones from the lowest to the highest set bit of `value` */
+static inline uint64_t arm64_plan_span(uint64_t value) {
+  if (value == 0)
+    return (0);
+
+  return (arm64_ones(arm64_highest_set_bit(value) + 1) &
+          ~arm64_ones(__builtin_ctzll(value)));
+}
+
+/*
+ * ORR of a value with a zero run filled, EOR clears the run again:
+ * either the ones of `value` or of its inversion span one run with holes
+ * which are a bitmask immediate themselves.
+ */
+static inline bool arm64_plan_orr_eor(uint64_t value, uint32_t rd,
+                                      struct arm64_constant_plan *plan) {
+  uint32_t n1, immr1, imms1, n2, immr2, imms2;
+  uint64_t filled;
+
+  for (int inverted = 0; inverted <= 1; inverted++) {
+    filled = arm64_plan_span(inverted ? ~value : value);
+    if (inverted)
+      filled = ~filled;
+    if (!arm64_encode_bit_masks(filled, &n1, &immr1, &imms1) ||
+        !arm64_encode_bit_masks(filled ^ value, &n2, &immr2, &imms2))
+      continue;
+
+    arm64_plan_logical(plan, ARM64_LOGICAL_ORR, n1, immr1, imms1,
+                       ARM64_REG_ZR, rd);
+    arm64_plan_logical(plan, ARM64_LOGICAL_EOR, n2, immr2, imms2, rd, rd);
+    return (true);
+  }
+
+  return (false);
+}
+
+/*
+ * Plans the cheapest known sequence building `value` in X register `rd`:
+ *
+ * 1. MOVZ or MOVN, when a single one does (MoveWidePreferred() values)
+ * 2. ORR with a bitmask immediate
+ * 3. MOVZ or MOVN with one MOVK
+ * 4. ORR with one MOVK, the bitmask agrees with `value` in 3 halfwords
+ * 5. ORR and EOR, a bitmask with a run of bits flipped by another one
+ * 6. MOVZ or MOVN with two MOVK, or ORR with two MOVK
+ * 7. MOVZ with three MOVK
+ *
+ * `rd` is 0 to 30, ORR would write SP for 31. Returns the number of
+ * instructions stored into `plan`.
+ */
+static inline uint32_t arm64_plan_constant(uint64_t value, uint32_t rd,
+                                           struct arm64_constant_plan *plan) {
+  uint32_t zeros, ones, hw, n, immr, imms, fill, chain;
+  uint64_t mask, rest, other;
+
+  plan->count = 0;
+  zeros = ones = 0;
+  for (hw = 0; hw < 4; hw++) {
+    zeros += arm64_halfword(value, hw) == 0;
+    ones += arm64_halfword(value, hw) == 0xFFFF;
+  }
+
+  /* MOVN is only worth it when it needs fewer MOVK than MOVZ */
+  fill = ones > zeros ? 0xFFFF : 0;
+  chain = 4 - (ones > zeros ? ones : zeros);
+  if (chain == 0)
+    chain = 1;
+
+  if (chain == 1) {
+    arm64_plan_move_wide_chain(value, fill, rd, plan);
+    return (plan->count);
+  }
+
+  if (arm64_encode_bit_masks(value, &n, &immr, &imms)) {
+    arm64_plan_logical(plan, ARM64_LOGICAL_ORR, n, immr, imms, ARM64_REG_ZR,
+                       rd);
+    return (plan->count);
+  }
+
+  if (chain == 2) {
+    arm64_plan_move_wide_chain(value, fill, rd, plan);
+    return (plan->count);
+  }
+
+  /*
+   * A bitmask which differs from `value` in halfword `hw` only. It has
+   * there zeros, ones, the halfword 32 bits away (32 bit or shorter
+   * elements) or the fill of the run through the other halfwords.
+   */
+  for (hw = 0; hw < 4; hw++) {
+    mask = 0xFFFFULL << (hw * 16);
+    rest = value & ~mask;
+    other = (value >> 32 | value << 32) & mask;
+
+    if (arm64_plan_orr_movk(value, rest, 2, rd, plan) ||
+        arm64_plan_orr_movk(value, rest | mask, 2, rd, plan) ||
+        arm64_plan_orr_movk(value, rest | other, 2, rd, plan) ||
+        arm64_plan_orr_movk(value, rest | (arm64_plan_span(rest) & mask), 2,
+                            rd, plan) ||
+        arm64_plan_orr_movk(value,
+                            ~(~value & ~mask) &
+                                ~(arm64_plan_span(~value & ~mask) & mask),
+                            2, rd, plan))
+      return (plan->count);
+  }
+
+  if (arm64_plan_orr_eor(value, rd, plan))
+    return (plan->count);
+
+  if (chain == 3) {
+    arm64_plan_move_wide_chain(value, fill, rd, plan);
+    return (plan->count);
+  }
+
+  /* Either 32 bit half replicated, MOVK fixes up the other one */
+  if (arm64_plan_orr_movk(value, (value << 32) | (value & 0xFFFFFFFF), 3,
+                          rd, plan) ||
+      arm64_plan_orr_movk(value, (value >> 32) | (value & ~0xFFFFFFFFULL), 3,
+                          rd, plan))
+    return (plan->count);
+
+  arm64_plan_move_wide_chain(value, fill, rd, plan);
+  return (plan->count);
+}
+
+#endif /* ARM64_BITMASK_H */
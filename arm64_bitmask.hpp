@@ -0,0 +1,341 @@
+/*
+ * Compile-time version of the bitmask immediate decoder from
+ * arm64_bitmask.h.
+ *
+ * Everything here is constexpr, so an assembler DSL can resolve logical
+ * immediates while compiling:
+ *
+ * 	constexpr uint64_t mask = arm64::decode_bitmask<1, 3, 0b011100>();
+ * 	constexpr auto enc = arm64::encode_bitmask<0xe000000003ffffffULL>();
+ *
+ * Both fail to compile if the encoding is UNDEFINED or the value is not
+ * encodable. Requires C++20 (<bit>).
+ *
+ * Defining ARM64_BITMASK_STATIC_VERIFY proves the table against the text
+ * fixtures with static_assert, which takes seconds of compile time and
+ * needs the generated arm64_fixture_data.h, so `make check` does it once.
+ */
+#ifndef ARM64_BITMASK_HPP
+#define ARM64_BITMASK_HPP
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+
+namespace arm64 {
+
+/*
+ * Register width specializations, W registers have no 64 bit element
+ * (immN must be 0) and their values are 32 bit wide.
+ */
+template <unsigned Width> struct bitmask_width;
+
+template <> struct bitmask_width<32> {
+  using value_type = uint32_t;
+  static constexpr uint32_t max_n = 0;
+};
+
+template <> struct bitmask_width<64> {
+  using value_type = uint64_t;
+  static constexpr uint32_t max_n = 1;
+};
+
+template <unsigned Width>
+using bitmask_value_t = typename bitmask_width<Width>::value_type;
+
+struct bitmask_encoding {
+  uint32_t n;
+  uint32_t immr;
+  uint32_t imms;
+
+  constexpr bool operator==(const bitmask_encoding &) const = default;
+};
+
+/*
+ * Creates a 64 bit value with `length` ones starting from lsb.
+ */
+constexpr uint64_t ones(uint32_t length) {
+  return (length >= 64 ? ~uint64_t{0} : (uint64_t{1} << length) - 1);
+}
+
+/*
+ * Circular shift to the right of the low `width` bits of `value`.
+ */
+constexpr uint64_t ror(uint64_t value, uint32_t shift_count, uint32_t width) {
+  if (width == 64)
+    return (std::rotr(value, static_cast<int>(shift_count)));
+
+  shift_count &= width - 1;
+  if (shift_count == 0)
+    return (value & ones(width));
+
+  return (((value >> shift_count) | (value << (width - shift_count))) &
+          ones(width));
+}
+
+/*
+ * Replicates `esize` bits of `value` up to `bit_count` bits.
+ */
+constexpr uint64_t replicate(uint64_t value, uint32_t esize,
+                             uint32_t bit_count) {
+  uint64_t result = value;
+
+  for (uint32_t size = esize; size < bit_count; size *= 2)
+    result |= result << size;
+
+  return (result & ones(bit_count));
+}
+
+/*
+ * DecodeBitMasks() for `Width` bit registers, std::nullopt is UNDEFINED.
+ */
+template <unsigned Width = 64>
+constexpr std::optional<bitmask_value_t<Width>>
+disasm_bit_masks(uint32_t n, uint32_t imms, uint32_t immr, bool logical_imm) {
+  uint32_t combined, levels, s, r, esize;
+  int length;
+
+  if (n > bitmask_width<Width>::max_n)
+    return (std::nullopt);
+
+  /* Highest set bit of immN:NOT(imms) */
+  combined = (n << 6) | (~imms & 0x3F);
+  length = 31 - std::countl_zero(combined);
+  if (length < 1)
+    return (std::nullopt);
+
+  levels = static_cast<uint32_t>(ones(length));
+  if (logical_imm && (imms & levels) == levels)
+    return (std::nullopt);
+
+  s = imms & levels;
+  r = immr & levels;
+  esize = 1U << length;
+
+  return (static_cast<bitmask_value_t<Width>>(
+      replicate(ror(ones(s + 1), r, esize), esize, Width)));
+}
+
+/*
+ * Inverse of disasm_bit_masks() for logical immediates.
+ */
+template <unsigned Width = 64>
+constexpr std::optional<bitmask_encoding>
+encode_bit_masks(bitmask_value_t<Width> value) {
+  uint64_t elem, mask;
+  uint32_t esize, start, count;
+
+  if (value == 0 || value == static_cast<bitmask_value_t<Width>>(~0ULL))
+    return (std::nullopt);
+
+  /* Smallest element which replicates to `value` */
+  for (esize = Width; esize > 2; esize /= 2) {
+    if (((value ^ (value >> (esize / 2))) & ones(esize / 2)) != 0)
+      break;
+  }
+
+  mask = ones(esize);
+  elem = value & mask;
+  if (std::has_single_bit((elem | (elem - 1)) + 1)) {
+    start = std::countr_zero(elem);
+    count = std::popcount(elem);
+  } else {
+    /* Ones wrap around the element, zeros must be contiguous */
+    elem = ~elem & mask;
+    if (!std::has_single_bit((elem | (elem - 1)) + 1))
+      return (std::nullopt);
+    start = std::countr_zero(elem) + std::popcount(elem);
+    count = esize - std::popcount(elem);
+  }
+
+  return (bitmask_encoding{esize == 64, (esize - start) & (esize - 1),
+                           (~(esize * 2 - 1) & 0x3F) | (count - 1)});
+}
+
+/*
+ * MoveWidePreferred(): true if the decoded value is also a MOVZ or MOVN
+ * immediate, so ORR with ZR isn't disassembled as MOV (bitmask immediate).
+ *
+ * The MOVN arm checks the run of width - 1 - s zeros, which starts at bit
+ * s + 1 - r, fits into one halfword. It accepts up to 16 zeros, like the
+ * MOVZ arm accepts up to 16 ones.
+ */
+template <unsigned Width = 64>
+constexpr bool move_wide_preferred(uint32_t n, uint32_t imms, uint32_t immr) {
+  constexpr int width = Width;
+  int s = static_cast<int>(imms), r = static_cast<int>(immr);
+
+  /* Element size must equal total immediate size */
+  if (Width == 64 && n != 1)
+    return (false);
+  if (Width == 32 && (n != 0 || (imms & 0x20) != 0))
+    return (false);
+
+  /* For MOVZ, imms must contain no more than 16 ones */
+  if (s < 16)
+    /* Ones must not span halfword boundary when rotated */
+    return ((-r & 15) <= 15 - s);
+
+  /* For MOVN, imms must contain no more than 16 zeros */
+  if (s >= width - 17)
+    /* Zeros must not span halfword boundary when rotated */
+    return (((s + 1 - r) & 15) <= s - (width - 17));
+
+  return (false);
+}
+
+/* Same index as bits [22:10] of logical (immediate) instructions */
+constexpr uint32_t bit_masks_index(uint32_t n, uint32_t imms, uint32_t immr) {
+  return (((n & 0x1) << 12) | ((immr & 0x3F) << 6) | (imms & 0x3F));
+}
+
+/*
+ * Decoded logical immediates of 64 bit registers, 0 marks UNDEFINED
+ * (it can't be a logical immediate).
+ */
+constexpr std::array<uint64_t, 8192> make_bit_masks_table() {
+  std::array<uint64_t, 8192> table{};
+
+  for (uint32_t i = 0; i < table.size(); i++)
+    table[i] = disasm_bit_masks<64>(i >> 12, i & 0x3F, (i >> 6) & 0x3F, true)
+                   .value_or(0);
+
+  return (table);
+}
+
+inline constexpr std::array<uint64_t, 8192> bit_masks_table =
+    make_bit_masks_table();
+
+/*
+ * Folds to the decoded value, does not compile if it is UNDEFINED.
+ */
+template <uint32_t N, uint32_t Immr, uint32_t Imms, unsigned Width = 64>
+consteval bitmask_value_t<Width> decode_bitmask() {
+  constexpr auto wmask = disasm_bit_masks<Width>(N, Imms, Immr, true);
+  static_assert(wmask.has_value(), "UNDEFINED logical immediate encoding");
+
+  return (*wmask);
+}
+
+/*
+ * Folds to the encoding, does not compile if `Value` is not encodable.
+ */
+template <uint64_t Value, unsigned Width = 64>
+consteval bitmask_encoding encode_bitmask() {
+  static_assert(Value <= ones(Width), "value is wider than the register");
+  constexpr auto enc =
+      encode_bit_masks<Width>(static_cast<bitmask_value_t<Width>>(Value));
+  static_assert(enc.has_value(), "value is not a logical immediate");
+
+  return (*enc);
+}
+
+#if defined(ARM64_BITMASK_STATIC_VERIFY)
+/* Same layout as the records main.c reads */
+struct arm64_fixture_record {
+  uint64_t value;
+  uint8_t n;
+  uint8_t immr;
+  uint8_t imms;
+  uint8_t esize;
+  uint8_t length;
+  uint8_t rotation;
+  uint8_t pad[2];
+};
+
+#define ARM64_FIXTURE_STORAGE inline constexpr
+#include "arm64_fixture_data.h"
+#undef ARM64_FIXTURE_STORAGE
+
+/*
+ * The table must hold exactly the 5334 values of
+ * all_possible_bitmask_imm.txt at their N:immr:imms, and encoding must
+ * invert decoding. immr bits above the element length are ignored by
+ * the decoder, such entries must repeat the canonical one.
+ */
+constexpr bool verify_bit_masks_table() {
+  uint32_t canonical = 0, index;
+
+  for (uint32_t i = 0; i < bit_masks_table.size(); i++) {
+    if (bit_masks_table[i] == 0)
+      continue;
+    auto enc = encode_bit_masks<64>(bit_masks_table[i]);
+    if (!enc)
+      return (false);
+    index = bit_masks_index(enc->n, enc->imms, enc->immr);
+    if (bit_masks_table[index] != bit_masks_table[i])
+      return (false);
+    canonical += index == i;
+  }
+
+  for (const auto &rec : arm64_fixture_embedded64) {
+    if (bit_masks_table[bit_masks_index(rec.n, rec.imms, rec.immr)] !=
+        rec.value)
+      return (false);
+  }
+
+  return (canonical == 5334 && std::size(arm64_fixture_embedded64) == 5334);
+}
+
+/* W register values of all_possible_bitmask_imm32.txt */
+constexpr bool verify_bit_masks32() {
+  for (const auto &rec : arm64_fixture_embedded32) {
+    if (disasm_bit_masks<32>(rec.n, rec.imms, rec.immr, true) != rec.value)
+      return (false);
+  }
+
+  return (std::size(arm64_fixture_embedded32) == 1302);
+}
+
+static_assert(verify_bit_masks_table(),
+              "table does not match all_possible_bitmask_imm.txt");
+static_assert(verify_bit_masks32(),
+              "decoder does not match all_possible_bitmask_imm32.txt");
+
+/*
+ * move_wide_preferred() must agree with the value: at most one non-zero
+ * halfword in it (MOVZ) or in its inversion (MOVN).
+ */
+template <unsigned Width> constexpr bool verify_move_wide_preferred() {
+  for (uint32_t i = 0; i < 8192; i++) {
+    uint32_t n = i >> 12, immr = (i >> 6) & 0x3F, imms = i & 0x3F;
+    auto value = disasm_bit_masks<Width>(n, imms, immr, true);
+    if (!value)
+      continue;
+
+    bool movz, movn;
+    int used = 0, unused = 0;
+    for (unsigned hw = 0; hw < Width; hw += 16) {
+      used += ((*value >> hw) & 0xFFFF) != 0;
+      unused += ((*value >> hw) & 0xFFFF) != 0xFFFF;
+    }
+    movz = used <= 1;
+    movn = unused <= 1;
+    if (move_wide_preferred<Width>(n, imms, immr) != (movz || movn))
+      return (false);
+  }
+
+  return (true);
+}
+
+static_assert(verify_move_wide_preferred<32>());
+static_assert(verify_move_wide_preferred<64>());
+
+/* First, last and a wrapping line of the fixture */
+static_assert(decode_bitmask<0, 0b000000, 0b111100>() == 0x5555555555555555);
+static_assert(decode_bitmask<1, 0b111111, 0b111110>() == 0xfffffffffffffffe);
+static_assert(decode_bitmask<1, 0b000011, 0b011100>() == 0xe000000003ffffff);
+static_assert(encode_bitmask<0xe000000003ffffff>() ==
+              bitmask_encoding{1, 0b000011, 0b011100});
+static_assert(decode_bitmask<0, 0b000000, 0b000111, 32>() == 0xff);
+static_assert(!disasm_bit_masks<32>(1, 0, 0, true).has_value());
+static_assert(move_wide_preferred<64>(1, 0b111110, 0b111111));
+static_assert(!move_wide_preferred<64>(1, 0b011100, 0b000011));
+#endif
+
+} // namespace arm64
+
+#endif /* ARM64_BITMASK_HPP */
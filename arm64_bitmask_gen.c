@@ -0,0 +1,51 @@
+/*
+ * Build time generator of the decode tables in libarm64bitmask. Prints
+ * them as const initialized data to stdout, entries come from the same
+ * *_table_entry() functions the header documents the tables with.
+ */
+#define ARM64_BITMASK_IMPLEMENTATION
+#include "arm64_bitmask.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+static void print_header(const char *type, const char *name,
+                         const char *size) {
+  printf("\nconst %s %s[%s] = {", type, name, size);
+}
+
+int main(void) {
+  uint32_t i;
+
+  printf("/* Generated by arm64_bitmask_gen, do not edit */\n");
+
+  print_header("uint64_t", "arm64_bit_masks_table",
+               "ARM64_BIT_MASKS_TABLE_SIZE");
+  for (i = 0; i < ARM64_BIT_MASKS_TABLE_SIZE; i++)
+    printf("%s0x%016" PRIx64 "ULL,", i % 4 == 0 ? "\n    " : " ",
+           arm64_bit_masks_table_entry(i));
+  printf("\n};\n");
+
+  print_header("uint32_t", "arm64_bit_masks32_table",
+               "ARM64_BIT_MASKS32_TABLE_SIZE");
+  for (i = 0; i < ARM64_BIT_MASKS32_TABLE_SIZE; i++)
+    printf("%s0x%08" PRIx32 ",", i % 6 == 0 ? "\n    " : " ",
+           arm64_bit_masks32_table_entry(i));
+  printf("\n};\n");
+
+  print_header("uint64_t", "arm64_move_wide_table",
+               "ARM64_MOVE_WIDE_TABLE_BITS / 64");
+  for (i = 0; i < ARM64_MOVE_WIDE_TABLE_BITS / 64; i++)
+    printf("%s0x%016" PRIx64 "ULL,", i % 4 == 0 ? "\n    " : " ",
+           arm64_move_wide_table_word(i));
+  printf("\n};\n");
+
+  print_header("uint8_t", "arm64_bitfield_alias_table",
+               "ARM64_BITFIELD_TABLE_SIZE");
+  for (i = 0; i < ARM64_BITFIELD_TABLE_SIZE; i++)
+    printf("%s%2u,", i % 16 == 0 ? "\n    " : " ",
+           arm64_bitfield_alias_table_entry(i));
+  printf("\n};\n");
+
+  return (ferror(stdout) || fflush(stdout) != 0);
+}
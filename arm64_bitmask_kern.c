@@ -0,0 +1,91 @@
+/*
+ * Freestanding build of arm64_bitmask_kern.h, compiled with
+ * -ffreestanding -fno-builtin. Everything is shifts, masks and a single
+ * multiply, which are plain instructions on arm64.
+ */
+#include "arm64_bitmask_kern.h"
+
+#define ARM64_KERN_LEN_2(x) x, x
+#define ARM64_KERN_LEN_4(x) ARM64_KERN_LEN_2(x), ARM64_KERN_LEN_2(x)
+#define ARM64_KERN_LEN_8(x) ARM64_KERN_LEN_4(x), ARM64_KERN_LEN_4(x)
+#define ARM64_KERN_LEN_16(x) ARM64_KERN_LEN_8(x), ARM64_KERN_LEN_8(x)
+#define ARM64_KERN_LEN_32(x) ARM64_KERN_LEN_16(x), ARM64_KERN_LEN_16(x)
+#define ARM64_KERN_LEN_64(x) ARM64_KERN_LEN_32(x), ARM64_KERN_LEN_32(x)
+
+/*
+ * Highest set bit of immN:NOT(imms), which is log2(esize). 0 stands for
+ * both -1 and 0, an UNDEFINED element (length < 1).
+ */
+static const uint8_t arm64_kern_length[128] = {
+    0,
+    0,
+    ARM64_KERN_LEN_2(1),
+    ARM64_KERN_LEN_4(2),
+    ARM64_KERN_LEN_8(3),
+    ARM64_KERN_LEN_16(4),
+    ARM64_KERN_LEN_32(5),
+    ARM64_KERN_LEN_64(6),
+};
+
+/* One at the start of every element, indexed by log2(esize) */
+static const uint64_t arm64_kern_replicate[7] = {
+    0xffffffffffffffffULL, 0x5555555555555555ULL, 0x1111111111111111ULL,
+    0x0101010101010101ULL, 0x0001000100010001ULL, 0x0000000100000001ULL,
+    0x0000000000000001ULL,
+};
+
+bool arm64_kern_disasm_bit_masks(uint32_t n, uint32_t imms, uint32_t immr,
+                                 bool logical_imm, uint32_t datasize,
+                                 uint64_t *wmask) {
+  uint64_t welem, emask;
+  uint32_t length, levels, s, r, esize;
+
+  length = arm64_kern_length[((n & 0x1) << 6) | (~imms & 0x3F)];
+  /* 64 bit element doesn't fit W registers */
+  if (length < 1 || (1U << length) > datasize)
+    return (false);
+
+  esize = 1U << length;
+  levels = esize - 1;
+  if (logical_imm && (imms & levels) == levels)
+    return (false);
+
+  s = imms & levels;
+  r = immr & levels;
+
+  /*
+   * s + 1 ones, s is at most 63, so the shift is in range. Rotation
+   * by 0 ORs the run with itself, there are no branches on immr.
+   */
+  welem = ~0ULL >> (63 - s);
+  emask = ~0ULL >> (64 - esize);
+  welem = ((welem >> r) | (welem << ((esize - r) & levels))) & emask;
+
+  *wmask = welem * arm64_kern_replicate[length];
+  *wmask &= ~0ULL >> (64 - datasize);
+
+  return (true);
+}
+
+bool arm64_kern_move_wide_preferred(uint32_t sf, uint32_t n, uint32_t imms,
+                                    uint32_t immr) {
+  uint32_t width;
+
+  width = sf == 1 ? 64 : 32;
+
+  /* Element size must equal total immediate size */
+  if (sf == 1 && n != 1)
+    return (false);
+  if (sf == 0 && (n != 0 || (imms & 0x20) != 0))
+    return (false);
+
+  /* No more than 16 ones, not spanning a halfword boundary (MOVZ) */
+  if (imms < 16)
+    return (((0 - immr) & 15) <= 15 - imms);
+
+  /* No more than 16 zeros, not spanning a halfword boundary (MOVN) */
+  if (imms >= width - 17)
+    return (((imms + 1 - immr) & 15) <= imms - (width - 17));
+
+  return (false);
+}
@@ -0,0 +1,39 @@
+/*
+ * Freestanding bitmask immediate decoder for kernel disassemblers such as
+ * ddb(4) on arm64.
+ *
+ * It needs no libc and no compiler runtime helpers: there is no stdio,
+ * no allocation and no __builtin_clz (a libgcc call on some targets).
+ * Instead of the 64 KiB table of arm64_bitmask.h it keeps 128 byte
+ * element lengths of immN:NOT(imms) and 7 replicate multipliers, the run
+ * of ones is made by a shift and rotated within the element without
+ * branches. `make kern-size` prints .text/.rodata of arm64_bitmask_kern.o
+ * and fails if they exceed KERN_BUDGET.
+ */
+#ifndef ARM64_BITMASK_KERN_H
+#define ARM64_BITMASK_KERN_H
+
+#if defined(_KERNEL)
+#include <sys/types.h>
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+/*
+ * DecodeBitMasks() for `datasize` (32 or 64) bit registers, the value is
+ * zero extended to 64 bits. Returns false if the encoding is UNDEFINED.
+ */
+bool arm64_kern_disasm_bit_masks(uint32_t n, uint32_t imms, uint32_t immr,
+                                 bool logical_imm, uint32_t datasize,
+                                 uint64_t *wmask);
+
+/*
+ * MoveWidePreferred(), true if MOVZ or MOVN gives the decoded value, so
+ * ORR with ZR is disassembled as MOV (wide immediate) by the MOVZ/MOVN
+ * encoding instead of MOV (bitmask immediate).
+ */
+bool arm64_kern_move_wide_preferred(uint32_t sf, uint32_t n, uint32_t imms,
+                                    uint32_t immr);
+
+#endif /* ARM64_BITMASK_KERN_H */
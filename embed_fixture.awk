@@ -0,0 +1,68 @@
+#
+# Compiles text fixtures into arrays of struct arm64_fixture_record for
+# main.c, one array per file, named by the `name` assignment before it:
+#
+# 	awk -f embed_fixture.awk name=arm64_fixture_embedded64 \
+# 	    all_possible_bitmask_imm.txt > arm64_fixture_data.h
+#
+# ARM64_FIXTURE_STORAGE defaults to `static const`, arm64_bitmask.hpp
+# makes the arrays constexpr. Lines are checked against the fixed layout
+# the harness parser accepts, the build fails on anything else rather
+# than embedding a broken corpus.
+#
+function bin(s, v, i) {
+	v = 0
+	for (i = 1; i <= length(s); i++)
+		v = v * 2 + substr(s, i, 1)
+	return (v)
+}
+
+function field(f, key, digits, re) {
+	if (substr(f, 1, length(key) + 1) != key "=" ||
+	    substr(f, length(key) + 2) !~ ("^" re "$") ||
+	    length(f) != length(key) + 1 + digits) {
+		printf("%s:%d: malformed %s\n", FILENAME, FNR, key) > "/dev/stderr"
+		failed = 1
+		exit 1
+	}
+	return (substr(f, length(key) + 2))
+}
+
+BEGIN {
+	print "/* Generated by embed_fixture.awk, do not edit */"
+	print ""
+	print "#ifndef ARM64_FIXTURE_STORAGE"
+	print "#define ARM64_FIXTURE_STORAGE static const"
+	print "#endif"
+}
+
+FNR == 1 {
+	if (open)
+		print "};"
+	printf("\nARM64_FIXTURE_STORAGE struct arm64_fixture_record %s[] = {\n",
+	    name)
+	open = 1
+}
+
+{
+	if (NF != 8 || $1 !~ /^[0-9a-f]+$/ || $2 !~ /^[01]+$/ ||
+	    length($2) != 4 * length($1)) {
+		printf("%s:%d: malformed line\n", FILENAME, FNR) > "/dev/stderr"
+		failed = 1
+		exit 1
+	}
+	printf("    {0x%sULL, %d, %d, %d, %d, %d, %d, {0, 0}},\n", $1,
+	    bin(field($6, "N", 1, "[01]")),
+	    bin(field($7, "immr", 6, "[01]+")),
+	    bin(field($8, "imms", 6, "[01]+")),
+	    field($3, "size", 2, "[0-9]+") + 0,
+	    field($4, "length", 2, "[0-9]+") + 0,
+	    field($5, "rotation", 2, "[0-9]+") + 0)
+}
+
+END {
+	if (failed)
+		exit 1
+	if (open)
+		print "};"
+}
@@ -1,9 +1,26 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arm64_bitmask.h"
+#include "arm64_bitmask_kern.h"
 
 static inline int
 flsl(long mask)
@@ -13,229 +30,3738 @@ flsl(long mask)
 	    8 * sizeof(mask) - __builtin_clzl((u_long)mask));
 }
 
-static bool arm64_is_bit_set(uint64_t value, uint32_t bit) {
-  return ((value >> bit) & 0x1);
+typedef bool (*arm64_bit_masks_fn)(uint32_t n, uint32_t imms, uint32_t immr,
+                                   bool logical_imm, uint64_t *wmask);
+
+typedef bool (*arm64_bit_masks32_fn)(uint32_t n, uint32_t imms, uint32_t immr,
+                                     bool logical_imm, uint32_t *wmask);
+
+/* Decoders used by the harness, switched to the table ones with `-t` */
+static arm64_bit_masks_fn arm64_bit_masks_decode = arm64_disasm_bit_masks;
+static arm64_bit_masks32_fn arm64_bit_masks32_decode =
+    arm64_disasm_bit_masks32;
+
+#if defined(ARM64_BITMASK_STATS)
+/* Counters of all threads as JSON, printed on exit with `-S` */
+static void arm64_stats_dump(FILE *stream) {
+  struct arm64_bitmask_stats total;
+  int threads;
+
+  threads = arm64_stats_collect(&total);
+  fprintf(stream,
+          "{\n  \"threads\": %d,\n  \"calls\": %lu,\n"
+          "  \"undefined\": {\"length\": %lu, \"all_ones_s\": %lu, "
+          "\"n\": %lu},\n  \"esize\": {",
+          threads, total.calls, total.undefined_length, total.undefined_ones,
+          total.undefined_n);
+  for (int length = 1; length <= 6; length++)
+    fprintf(stream, "%s\"%d\": %lu", length > 1 ? ", " : "", 1 << length,
+            total.esize[length]);
+  fprintf(stream, "},\n  \"rotation\": [");
+  for (int r = 0; r < 64; r++)
+    fprintf(stream, "%s%lu", r > 0 ? ", " : "", total.rotation[r]);
+  fprintf(stream,
+          "],\n  \"move_wide\": {\"calls\": %lu, \"preferred\": %lu},\n"
+          "  \"mov_alias\": %lu\n}\n",
+          total.move_wide_calls, total.move_wide_preferred, total.mov_alias);
 }
 
+static void arm64_stats_atexit(void) { arm64_stats_dump(stderr); }
+#endif
+
 /*
- * Returns the highest set bit of `value`, search performs from
- * most significant bit. If highest set bit is not found, we return -1.
+ * Buffered report output. Text is formatted by hand straight into fixed
+ * blocks, when all blocks are filled they are written with one writev().
+ * Formatting matches printf("%lx") and printf("%lu").
  */
-static int arm64_highest_set_bit(uint64_t value) {
-  for (int i = sizeof(uint64_t) * CHAR_BIT - 1; i >= 0; i--) {
-    if (arm64_is_bit_set(value, i))
-      return (i);
+#define REPORT_BLOCK_SIZE (64 * 1024)
+#define REPORT_BLOCKS 16
+/* Longest piece appended at once, a line never spans two blocks */
+#define REPORT_LINE_MAX 256
+
+struct report_writer {
+  int fd;
+  int error;
+  int block;
+  size_t used;
+  char *blocks;
+  struct iovec iov[REPORT_BLOCKS];
+};
+
+static struct report_writer report;
+
+static int report_init(struct report_writer *w, int fd) {
+  memset(w, 0, sizeof(*w));
+  w->fd = fd;
+  w->blocks = malloc(REPORT_BLOCKS * REPORT_BLOCK_SIZE);
+
+  return (w->blocks == NULL ? -1 : 0);
+}
+
+static int report_flush(struct report_writer *w) {
+  struct iovec *iov;
+  ssize_t written;
+  int iovcnt;
+
+  if (w->blocks == NULL)
+    return (w->error);
+
+  /* Filled blocks got their vectors in report_reserve() */
+  w->iov[w->block].iov_base = w->blocks + (size_t)w->block * REPORT_BLOCK_SIZE;
+  w->iov[w->block].iov_len = w->used;
+
+  iov = w->iov;
+  iovcnt = w->block + 1;
+  while (iovcnt > 0 && !w->error) {
+    written = writev(w->fd, iov, iovcnt);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      w->error = errno;
+      break;
+    }
+    /* Skips fully written vectors and advances a partial one */
+    while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
   }
 
-  return (-1);
+  w->block = 0;
+  w->used = 0;
+  return (w->error);
+}
+
+/* Returns the errno of the first failed write, or 0 */
+static int report_close(struct report_writer *w) {
+  int error;
+
+  error = report_flush(w);
+  free(w->blocks);
+  w->blocks = NULL;
+
+  return (error);
 }
 
 /*
- * Creates a 64 bit value with a specified number of ones starting from lsb.
- *
- * Example:
- * 	`length` = 7
- * 	`result` = 0b1111111
+ * Returns room for at least REPORT_LINE_MAX bytes, the caller advances
+ * `used` by the amount written.
  */
-static uint64_t arm64_ones(uint32_t length) { return ((1ULL << length) - 1); }
+static char *report_reserve(struct report_writer *w) {
+  if (REPORT_BLOCK_SIZE - w->used < REPORT_LINE_MAX) {
+    if (w->block == REPORT_BLOCKS - 1) {
+      /* The rest can't reach the output, report_atexit() tells why */
+      if (report_flush(w) != 0)
+        exit(1);
+    } else {
+      w->iov[w->block].iov_base =
+          w->blocks + (size_t)w->block * REPORT_BLOCK_SIZE;
+      w->iov[w->block].iov_len = w->used;
+      w->block++;
+      w->used = 0;
+    }
+  }
 
-/* Replicates `value` bits `esize` times with a fixed size `bit_count`.
- *
- * Example:
- * 	`value`  = 0b10010011, `esize` = 8, `bit_count` = 32
- * 	`result` = 0b10010011_10010011_10010011_10010011
- */
-static uint64_t arm64_replicate(uint64_t value, uint32_t esize, int bit_count) {
-  uint64_t result, set_bits;
+  return (w->blocks + (size_t)w->block * REPORT_BLOCK_SIZE + w->used);
+}
+
+static char *report_format_str(char *p, const char *str, size_t len) {
+  memcpy(p, str, len);
+  return (p + len);
+}
 
-  result = value;
+#define report_format_lit(p, lit) report_format_str(p, lit, sizeof(lit) - 1)
 
-  for (set_bits = esize; set_bits < bit_count; set_bits += esize) {
-    value <<= esize;
-    result |= value;
+static char *report_format_hex(char *p, uint64_t value) {
+  static const char digits[] = "0123456789abcdef";
+  int count;
+
+  /* Number of nibbles, at least one for zero */
+  count = (64 - __builtin_clzll(value | 1) + 3) / 4;
+  for (int i = count - 1; i >= 0; i--) {
+    p[i] = digits[value & 0xF];
+    value >>= 4;
   }
 
-  return (result);
+  return (p + count);
+}
+
+static char *report_format_dec(char *p, uint64_t value) {
+  char tmp[20];
+  int count;
+
+  count = 0;
+  do {
+    tmp[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+
+  while (count > 0)
+    *p++ = tmp[--count];
+
+  return (p);
+}
+
+static void report_commit(struct report_writer *w, const char *end) {
+  w->used = end - (w->blocks + (size_t)w->block * REPORT_BLOCK_SIZE);
 }
 
 /*
- * Performs circular shift to the right, shifts all bits of a binary number
- * `value` by `shift_count`, the least significant bit is pushed out.
- *
- * Example:
- * 	`value`  = 0b0001_1101_0110_1011, `shift_count` = 2, `width` = 16
- *	`result` = 0b1100_0111_0101_1010
+ * A truncated report must not pass as a golden output, a failed write
+ * overrides the exit status.
  */
-static uint64_t arm64_ror(uint64_t value, uint32_t shift_count,
-                          uint32_t width) {
-  uint64_t result, right_shift, left_shift;
+static void report_atexit(void) {
+  int error;
 
-  right_shift = shift_count;
-  left_shift = width - shift_count;
-  result = value >> right_shift;
-  result |= value << left_shift;
+  error = report_close(&report);
+  if (error != 0) {
+    fprintf(stderr, "report: write failed: %s\n", strerror(error));
+    _exit(1);
+  }
+}
 
-  /*
-   * Ignores redundant bits that we can get in result after left shift
-   */
-  if (width < 64)
-    result &= arm64_ones(width);
+/*
+ * printf() for messages of the fixture paths. They go through the report
+ * once it is set up, so an ERROR line follows the lines it refers to even
+ * on a line buffered terminal.
+ */
+static void report_printf(const char *fmt, ...) {
+  va_list ap;
+  char *p;
+  int len;
+
+  va_start(ap, fmt);
+  if (report.blocks == NULL) {
+    vprintf(fmt, ap);
+    va_end(ap);
+    return;
+  }
 
-  return (result);
+  p = report_reserve(&report);
+  len = vsnprintf(p, REPORT_LINE_MAX, fmt, ap);
+  va_end(ap);
+  if (len > 0)
+    report_commit(&report, p + (len < REPORT_LINE_MAX ? len
+                                                      : REPORT_LINE_MAX - 1));
 }
 
 /*
- * Returns true if bitmask is decoded successfully.
- * According to Arm64 documentation we must return UNDEFINED
- * in case of invalid parameters, thus we use false as UNDEFINED
- * and on high flow of codebase we must print undefined.
+ * Outcome of the checks of one fixture record. Checking and reporting are
+ * split, so records can be checked on one thread and reported in order
+ * on another.
  */
-static bool arm64_disasm_bit_masks(uint32_t n, uint32_t imms, uint32_t immr,
-                                   bool logical_imm, uint64_t *wmask) {
-  uint64_t welem;
-  uint32_t levels, s, r;
-  int length, length2, esize;
+enum fixture_error {
+  FIXTURE_OK = 0,
+  /* size, length and rotation columns don't describe the value */
+  FIXTURE_ERROR_COLUMNS,
+  FIXTURE_ERROR_DECODED,
+  FIXTURE_ERROR_ENCODED,
+  FIXTURE_ERROR_INSN,
+  /* Not accepted by arm64_is_bitmask_imm_batch() */
+  FIXTURE_ERROR_INVALID,
+};
 
-  /*
-   * Finds the highest set bit of immN:NOT(imms).
-   * Total bit count of immN(1) and imms(6) is 7,
-   * thus we start from 6 index.
-   */
-  length = arm64_highest_set_bit((n << 6) | (~imms & 0x3F));
-  length2 = flsl((n << 6) | (~imms & 0x3F)) - 1;
+struct fixture_result {
+  uint64_t wmask;
+  /* Instruction word which failed FIXTURE_ERROR_INSN */
+  uint32_t insn;
+  bool decoded;
+  enum fixture_error error;
+};
 
-  if (length < 1)
-    return (false);
+static bool compare_input_imm_with_decoded_result(uint64_t imm, uint64_t immn,
+                                                  uint64_t immr, uint64_t imms,
+                                                  uint32_t datasize,
+                                                  struct fixture_result *res) {
+  uint32_t wmask32 = 0;
+
+  res->wmask = 0;
+  if (datasize == 32) {
+    res->decoded =
+        arm64_bit_masks32_decode(immn, imms, immr, true, &wmask32);
+    res->wmask = wmask32;
+  } else {
+    res->decoded =
+        arm64_bit_masks_decode(immn, imms, immr, true, &res->wmask);
+  }
 
-  levels = arm64_ones(length);
+  return (imm == res->wmask);
+}
+
+static void report_decoded_result(uint64_t imm, uint64_t immn, uint64_t immr,
+                                  uint64_t imms,
+                                  const struct fixture_result *res) {
+  char *p;
 
   /*
-   * For logical immediates an all-ones value of S is reserved
-   * since it would generate a useless all-ones result (many times)
+   * "imm: 0x%lx\timmn: %lu immr: %lu imms: %lu, decoded: %d,
+   * arm64_disasm_bitmask: %lx, imm == wmask: %d\n"
    */
-  if (logical_imm && (imms & levels) == levels)
-    return (false);
+  p = report_reserve(&report);
+  p = report_format_lit(p, "imm: 0x");
+  p = report_format_hex(p, imm);
+  p = report_format_lit(p, "\timmn: ");
+  p = report_format_dec(p, immn);
+  p = report_format_lit(p, " immr: ");
+  p = report_format_dec(p, immr);
+  p = report_format_lit(p, " imms: ");
+  p = report_format_dec(p, imms);
+  p = report_format_lit(p, ", decoded: ");
+  p = report_format_dec(p, res->decoded);
+  p = report_format_lit(p, ", arm64_disasm_bitmask: ");
+  p = report_format_hex(p, res->wmask);
+  p = report_format_lit(p, ", imm == wmask: ");
+  p = report_format_dec(p, imm == res->wmask);
+  p = report_format_lit(p, "\n");
+  report_commit(&report, p);
+}
 
-  s = imms & levels;
-  r = immr & levels;
+static bool compare_input_imm_with_encoded_result(uint64_t imm, uint64_t immn,
+                                                  uint64_t immr, uint64_t imms,
+                                                  uint32_t datasize) {
+  uint32_t n, r, s;
+  bool is_encoded;
+
+  if (datasize == 32)
+    is_encoded = imm <= UINT32_MAX && arm64_encode_bit_masks32(imm, &n, &r, &s);
+  else
+    is_encoded = arm64_encode_bit_masks(imm, &n, &r, &s);
 
-  esize = 1 << length;
-  welem = arm64_ones(s + 1);
-  *wmask = arm64_ror(welem, r, esize);
-  *wmask = arm64_replicate(*wmask, esize, sizeof(uint64_t) * CHAR_BIT);
+  return (is_encoded && n == immn && r == immr && s == imms);
+}
+
+/*
+ * Places fixture fields into AND, ORR, EOR and ANDS (immediate) words with
+ * X or W registers and checks arm64_disasm_logical_imm() gives back every
+ * field. The first failing word is stored to `failed`.
+ */
+static bool compare_input_imm_with_decoded_insn(uint64_t imm, uint64_t immn,
+                                                uint64_t immr, uint64_t imms,
+                                                uint32_t datasize,
+                                                uint32_t *failed) {
+  struct arm64_logical_imm_insn decoded;
+  enum arm64_logical_alias alias;
+  uint32_t insn, op, sf;
+
+  sf = datasize == 64;
+  for (op = ARM64_LOGICAL_AND; op <= ARM64_LOGICAL_ANDS; op++) {
+    /* <op> xzr, xzr, #imm exercises both MOV and TST aliases */
+    insn = 0x12000000 | (sf << 31) | (op << 29) | (immn << 22) |
+           (immr << 16) | (imms << 10) | (ARM64_REG_ZR << 5) | ARM64_REG_ZR;
+
+    alias = ARM64_LOGICAL_ALIAS_NONE;
+    if (op == ARM64_LOGICAL_ORR && !arm64_move_wide_preferred(sf, immn, imms,
+                                                              immr))
+      alias = ARM64_LOGICAL_ALIAS_MOV;
+    if (op == ARM64_LOGICAL_ANDS)
+      alias = ARM64_LOGICAL_ALIAS_TST;
+
+    if (!arm64_disasm_logical_imm(insn, &decoded) || decoded.imm != imm ||
+        decoded.op != op || decoded.alias != alias || decoded.sf != sf ||
+        decoded.rd != ARM64_REG_ZR || decoded.rn != ARM64_REG_ZR) {
+      *failed = insn;
+      return (false);
+    }
+  }
 
   return (true);
 }
 
 /*
- * Returns true if bitmask immediate would generate an immediate value that
- * also could be represented by a single MOVZ, MOVN or MOV (wide immediate)
- * instruction. Also, this function determines should we use
- * MOV (bitmask immediate) alias or ORR (immediate).
+ * Binary fixture, a header followed by fixed-width records in host byte
+ * order, so a mapped file is iterated directly without any parsing.
+ * Records follow the text fixture columns: value, size, length, rotation,
+ * N, immr and imms. The header also keeps register width of the corpus.
+ */
+#define ARM64_FIXTURE_MAGIC "A64BMIMM"
+#define ARM64_FIXTURE_VERSION 2
+#define ARM64_FIXTURE_BYTE_ORDER 0x01020304
+
+struct arm64_fixture_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t record_size;
+  uint32_t datasize;
+  uint64_t count;
+  /* FNV-1a of all records */
+  uint64_t checksum;
+};
+
+struct arm64_fixture_record {
+  uint64_t value;
+  uint8_t n;
+  uint8_t immr;
+  uint8_t imms;
+  uint8_t esize;
+  uint8_t length;
+  uint8_t rotation;
+  uint8_t pad[2];
+};
+
+_Static_assert(sizeof(struct arm64_fixture_header) == 40,
+               "fixture header layout");
+_Static_assert(sizeof(struct arm64_fixture_record) == 16,
+               "fixture record layout");
+
+/*
+ * Both text fixtures as record arrays in .rodata, generated from the
+ * files by the Makefile. The harness checks them without any file I/O,
+ * so it runs from any directory. -F checks a text fixture file instead.
+ */
+#include "arm64_fixture_data.h"
+
+static uint64_t
+arm64_fixture_checksum(const struct arm64_fixture_record *records,
+                       uint64_t count) {
+  const uint8_t *p, *end;
+  uint64_t hash;
+
+  hash = 0xcbf29ce484222325ULL;
+  p = (const uint8_t *)records;
+  end = p + count * sizeof(*records);
+  for (; p < end; p++) {
+    hash ^= *p;
+    hash *= 0x100000001b3ULL;
+  }
+
+  return (hash);
+}
+
+static int write_binary_fixture(const char *path,
+                                const struct arm64_fixture_record *records,
+                                uint64_t count, uint32_t datasize) {
+  struct arm64_fixture_header header;
+  FILE *file;
+  int error;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ARM64_FIXTURE_MAGIC, sizeof(header.magic));
+  header.version = ARM64_FIXTURE_VERSION;
+  header.byte_order = ARM64_FIXTURE_BYTE_ORDER;
+  header.record_size = sizeof(*records);
+  header.datasize = datasize;
+  header.count = count;
+  header.checksum = arm64_fixture_checksum(records, count);
+
+  file = fopen(path, "wb");
+  if (file == NULL) {
+    report_printf("fopen(): failed.");
+    return (1);
+  }
+
+  error = fwrite(&header, sizeof(header), 1, file) != 1 ||
+          fwrite(records, sizeof(*records), count, file) != count;
+  error |= fclose(file) != 0;
+  if (error)
+    report_printf("fwrite(): failed.");
+
+  return (error);
+}
+
+/*
+ * Maps binary fixture at `path` and validates its header and checksum,
+ * records are returned in place. Must be released with munmap() of
+ * `*map_size` bytes starting at the header.
+ */
+static const struct arm64_fixture_record *
+map_binary_fixture(const char *path, uint64_t *count, uint32_t *datasize,
+                   size_t *map_size) {
+  const struct arm64_fixture_header *header;
+  const struct arm64_fixture_record *records;
+  struct stat sb;
+  void *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    report_printf("open(): failed.");
+    return (NULL);
+  }
+  if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(*header)) {
+    report_printf("ERROR: fixture is too short\n");
+    close(fd);
+    return (NULL);
+  }
+
+  map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    report_printf("mmap(): failed.");
+    return (NULL);
+  }
+
+  header = map;
+  records = (const struct arm64_fixture_record *)(header + 1);
+  if (memcmp(header->magic, ARM64_FIXTURE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != ARM64_FIXTURE_VERSION ||
+      header->byte_order != ARM64_FIXTURE_BYTE_ORDER ||
+      header->record_size != sizeof(*records) ||
+      (header->datasize != 32 && header->datasize != 64) ||
+      header->count > (sb.st_size - sizeof(*header)) / sizeof(*records) ||
+      header->checksum != arm64_fixture_checksum(records, header->count)) {
+    report_printf("ERROR: fixture header or checksum mismatch\n");
+    munmap(map, sb.st_size);
+    return (NULL);
+  }
+
+  *count = header->count;
+  *datasize = header->datasize;
+  *map_size = sb.st_size;
+  return (records);
+}
+
+/*
+ * Text fixture parser, lines look like
+ *
+ * 5555555555555555 0101...0101 size=02 length=00 rotation=00 N=0 immr=000000
+ * imms=111100
  *
- * Example:
- * 	  `sf` = 1, `immn` = 1, `imms` = 0b011100, `immr` = 0b000011
- * 	   First of all, we define `width`, since `sf` is 1 `width` will be 64.
- * 	   Next step is to combine `immn` and `imms` to check element size
- * 	   on total immediate size. So, immN:imms(7 bit) = 0b1011100.
- * 	   and immN:imms matches to 0b1xxxxxx pattern. We skip checks
- * 	   "imms < 16", imms greater than 16 and `imms` is not greater than
- * 	   `width` - 15, thus move wide is not preferred and immediate
- * 	   value e000000003ffffff can be used for MOV (bitmask immediate)
- * 	   if Rn register is 31.
- */
-static bool arm64_move_wide_preferred(int sf, uint32_t immn, uint32_t imms,
-                                      uint32_t immr) {
-  int width;
-
-  width = sf == 1 ? 64 : 32;
+ * (one line), value columns are 32 bits wide in the W register fixture.
+ * Parsing is a single pass over the buffer without allocation or global
+ * state, so it is safe to run on several chunks in parallel.
+ */
+static bool arm64_fixture_expect(const char **p, const char *end,
+                                 const char *literal) {
+  size_t len;
 
-  /*
-   * Element size must equal total immediate size.
-   * - for 64 bit immN:imms == '0b1xxxxxx'
-   * - for 32 bit immN:imms == '0b00xxxxx'
-   * Since, we know that immN:imms is 7 bit and patterns only take into
-   * account msb bits, no need to make bit pattern and masks.
-   * Hence, we can check only certain bits.
-   */
-  if (sf == 1 && immn != 1)
+  len = strlen(literal);
+  if ((size_t)(end - *p) < len || memcmp(*p, literal, len) != 0)
     return (false);
-  if (sf == 0 && (immn != 0 || arm64_is_bit_set(imms, 6)))
+
+  *p += len;
+  return (true);
+}
+
+/*
+ * Reads exactly `digits` digits in `base` (2, 10 or 16, lowercase).
+ */
+static bool arm64_fixture_number(const char **p, const char *end, int digits,
+                                 int base, uint64_t *out) {
+  uint64_t value;
+  int digit;
+  char c;
+
+  if (end - *p < digits)
     return (false);
 
-  /* For MOVZ, imms must contain no more than 16 ones */
-  if (imms < 16)
-    /* Ones must not span halfword boundary when rotated */
-    return (-immr % 16 <= 15 - imms);
+  value = 0;
+  for (int i = 0; i < digits; i++) {
+    c = (*p)[i];
+    if (c >= '0' && c <= '9')
+      digit = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      digit = c - 'a' + 10;
+    else
+      return (false);
+    if (digit >= base)
+      return (false);
+    value = value * base + digit;
+  }
+
+  *p += digits;
+  *out = value;
+  return (true);
+}
+
+/*
+ * Parses one line at `p` into `rec`, returns the start of the next line
+ * or NULL if the line is malformed. The last line may lack '\n'.
+ */
+static const char *arm64_fixture_parse_line(const char *p, const char *end,
+                                            uint32_t datasize,
+                                            struct arm64_fixture_record *rec) {
+  uint64_t value, bits, esize, length, rotation, n, immr, imms;
 
-  /* For MOVZ, imms must contain no more than 16 zeros */
-  if (imms >= width - 15)
-    /* Zeros must not span halfword boundary when rotated */
-    return (immr % 16 <= imms - width - 15);
+  if (!arm64_fixture_number(&p, end, datasize / 4, 16, &value) ||
+      !arm64_fixture_expect(&p, end, " ") ||
+      !arm64_fixture_number(&p, end, datasize, 2, &bits) || bits != value ||
+      !arm64_fixture_expect(&p, end, " size=") ||
+      !arm64_fixture_number(&p, end, 2, 10, &esize) ||
+      !arm64_fixture_expect(&p, end, " length=") ||
+      !arm64_fixture_number(&p, end, 2, 10, &length) ||
+      !arm64_fixture_expect(&p, end, " rotation=") ||
+      !arm64_fixture_number(&p, end, 2, 10, &rotation) ||
+      !arm64_fixture_expect(&p, end, " N=") ||
+      !arm64_fixture_number(&p, end, 1, 2, &n) ||
+      !arm64_fixture_expect(&p, end, " immr=") ||
+      !arm64_fixture_number(&p, end, 6, 2, &immr) ||
+      !arm64_fixture_expect(&p, end, " imms=") ||
+      !arm64_fixture_number(&p, end, 6, 2, &imms))
+    return (NULL);
 
-  return (false);
+  if (p < end && !arm64_fixture_expect(&p, end, "\n"))
+    return (NULL);
+
+  memset(rec, 0, sizeof(*rec));
+  rec->value = value;
+  rec->esize = esize;
+  rec->length = length;
+  rec->rotation = rotation;
+  rec->n = n;
+  rec->immr = immr;
+  rec->imms = imms;
+
+  return (p);
 }
 
-static void compare_input_imm_with_decoded_result(uint64_t imm, uint64_t immn,
-                                                  uint64_t immr, uint64_t imms,
-                                                  uint64_t *wmask) {
-  bool is_decoded = false;
+static uint64_t arm64_fixture_count_lines(const char *p, const char *end) {
+  const char *nl;
+  uint64_t lines;
 
-  printf("imm: 0x%lx\timmn: %lu immr: %lu imms: %lu", imm, immn, immr, imms);
+  for (lines = 0; p < end; lines++) {
+    nl = memchr(p, '\n', end - p);
+    p = nl == NULL ? end : nl + 1;
+  }
 
-  is_decoded = arm64_disasm_bit_masks(immn, imms, immr, true, wmask);
-  printf(", decoded: %d, arm64_disasm_bitmask: %lx, imm == wmask: %d\n",
-         is_decoded, *wmask, imm == *wmask);
+  return (lines);
+}
 
-  if (imm != *wmask) {
-    printf("ERROR: decoded result is not equal to expected value\n");
-    exit(1);
+#define ARM64_FIXTURE_MAX_THREADS 64
+
+struct arm64_fixture_chunk {
+  const char *start;
+  const char *end;
+  struct arm64_fixture_record *records;
+  uint32_t datasize;
+  uint64_t lines;
+  /* Line of the chunk that failed to parse, or UINT64_MAX */
+  uint64_t error_line;
+};
+
+static void *arm64_fixture_count_chunk(void *arg) {
+  struct arm64_fixture_chunk *chunk = arg;
+
+  chunk->lines = arm64_fixture_count_lines(chunk->start, chunk->end);
+  return (NULL);
+}
+
+static void *arm64_fixture_parse_chunk(void *arg) {
+  struct arm64_fixture_chunk *chunk = arg;
+  const char *p;
+
+  chunk->error_line = UINT64_MAX;
+  p = chunk->start;
+  for (uint64_t i = 0; i < chunk->lines; i++) {
+    p = arm64_fixture_parse_line(p, chunk->end, chunk->datasize,
+                                 &chunk->records[i]);
+    if (p == NULL) {
+      chunk->error_line = i;
+      break;
+    }
   }
+
+  return (NULL);
 }
 
-int main() {
-  FILE *file = NULL;
-  char *line = NULL;
-  uint64_t wmask = 0;
-  size_t len = 0;
-  ssize_t read = 0;
-  uint64_t immn = 0;
-  uint64_t immr = 0;
-  uint64_t imms = 0;
-  uint64_t expected_imm = 0;
-  char *subline = NULL;
+/*
+ * Runs `fn` over every chunk, on the calling thread if there is only one.
+ */
+static void arm64_fixture_run_chunks(struct arm64_fixture_chunk *chunks,
+                                     int nchunks, void *(*fn)(void *)) {
+  pthread_t threads[ARM64_FIXTURE_MAX_THREADS];
+  int started;
 
-  file = fopen("./all_possible_bitmask_imm.txt", "r");
-  if (file == NULL) {
-    printf("fopen(): failed.");
-    return 1;
+  for (started = 1; started < nchunks; started++) {
+    if (pthread_create(&threads[started], NULL, fn, &chunks[started]) != 0)
+      break;
   }
+  fn(&chunks[0]);
+  /* Chunks without a thread are parsed here */
+  for (int i = started; i < nchunks; i++)
+    fn(&chunks[i]);
+  for (int i = 1; i < started; i++)
+    pthread_join(threads[i], NULL);
+}
+
+/*
+ * Parses the whole text fixture in `buf` with up to `nthreads` threads.
+ * The buffer is split into chunks on line boundaries; lines are counted
+ * first so every chunk parses straight into its slice of one array.
+ * Returns malloc()ed records or NULL, in the latter case `*count` holds
+ * the number of the malformed line (from 1) or 0 if allocation failed.
+ */
+static struct arm64_fixture_record *
+arm64_fixture_parse(const char *buf, size_t size, uint32_t datasize,
+                    int nthreads, uint64_t *count) {
+  struct arm64_fixture_chunk chunks[ARM64_FIXTURE_MAX_THREADS];
+  struct arm64_fixture_record *records;
+  const char *p, *end, *nl;
+  uint64_t total;
+  int nchunks;
 
-  while ((read = getline(&line, &len, file)) != -1) {
-    subline = strtok(line, " ");
-    expected_imm = strtoull(subline, NULL, 16);
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > ARM64_FIXTURE_MAX_THREADS)
+    nthreads = ARM64_FIXTURE_MAX_THREADS;
 
-    for (int i = 1; subline != NULL; ++i) {
-      subline = strtok(NULL, " ");
-      if (i == 5)
-        immn = atoi(subline + 2);
-      if (i == 6)
-        immr = strtoul(subline + 5, NULL, 2);
-      if (i == 7)
-        imms = strtoul(subline + 5, NULL, 2);
+  p = buf;
+  end = buf + size;
+  for (nchunks = 0; nchunks < nthreads && p < end; nchunks++) {
+    chunks[nchunks].start = p;
+    chunks[nchunks].datasize = datasize;
+    p = buf + size / nthreads * (nchunks + 1);
+    if (nchunks == nthreads - 1 || p >= end) {
+      p = end;
+    } else if (p > chunks[nchunks].start) {
+      nl = memchr(p - 1, '\n', end - (p - 1));
+      p = nl == NULL ? end : nl + 1;
     }
+    chunks[nchunks].end = p;
+  }
 
-#if 1
-    compare_input_imm_with_decoded_result(expected_imm, immn, immr, imms,
-                                          &wmask);
-#else
-    printf("\torr\tsp, x1, #0x%d\n", expected_imm);
+  arm64_fixture_run_chunks(chunks, nchunks, arm64_fixture_count_chunk);
+
+  total = 0;
+  for (int i = 0; i < nchunks; i++)
+    total += chunks[i].lines;
+
+  records = malloc((total == 0 ? 1 : total) * sizeof(*records));
+  if (records == NULL) {
+    *count = 0;
+    return (NULL);
+  }
+
+  total = 0;
+  for (int i = 0; i < nchunks; i++) {
+    chunks[i].records = records + total;
+    total += chunks[i].lines;
+  }
+
+  arm64_fixture_run_chunks(chunks, nchunks, arm64_fixture_parse_chunk);
+
+  total = 0;
+  for (int i = 0; i < nchunks; i++) {
+    if (chunks[i].error_line != UINT64_MAX) {
+      free(records);
+      *count = total + chunks[i].error_line + 1;
+      return (NULL);
+    }
+    total += chunks[i].lines;
+  }
+
+  *count = total;
+  return (records);
+}
+
+/*
+ * Maps and parses the text fixture at `path`, see arm64_fixture_parse().
+ */
+static struct arm64_fixture_record *
+read_text_fixture(const char *path, uint32_t datasize, int nthreads,
+                  uint64_t *count) {
+  struct arm64_fixture_record *records;
+  struct stat sb;
+  void *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    report_printf("fopen(): failed.");
+    return (NULL);
+  }
+  if (fstat(fd, &sb) != 0) {
+    report_printf("fstat(): failed.");
+    close(fd);
+    return (NULL);
+  }
+
+  map = NULL;
+  if (sb.st_size > 0) {
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      report_printf("mmap(): failed.");
+      close(fd);
+      return (NULL);
+    }
+  }
+  close(fd);
+
+  records = arm64_fixture_parse(map, sb.st_size, datasize, nthreads, count);
+  if (records == NULL && *count != 0)
+    report_printf("ERROR: malformed fixture line %lu\n", *count);
+  else if (records == NULL)
+    report_printf("malloc(): failed.");
+
+  if (map != NULL)
+    munmap(map, sb.st_size);
+  return (records);
+}
+
+/*
+ * Runs the checks of one record in order and stops at the first failing
+ * one. Nothing is printed, see report_fixture_result().
+ */
+static void check_fixture_fields(const struct arm64_fixture_record *rec,
+                                 uint32_t datasize,
+                                 struct fixture_result *res) {
+  uint64_t columns;
+
+  memset(res, 0, sizeof(*res));
+
+  /*
+   * Columns come from the file, they are range checked before anything
+   * computes with them: size is a power of 2 the register holds, length
+   * leaves a zero in the element and rotation stays inside it.
+   */
+  if (rec->esize < 2 || rec->esize > datasize ||
+      (rec->esize & (rec->esize - 1)) != 0 ||
+      rec->length >= rec->esize - 1 || rec->rotation >= rec->esize ||
+      rec->n > 1 || rec->immr > 0x3F || rec->imms > 0x3F) {
+    res->error = FIXTURE_ERROR_COLUMNS;
+    return;
+  }
+
+  /* size, length and rotation columns must describe the same value */
+  columns = arm64_ror(arm64_ones(rec->length + 1), rec->rotation, rec->esize);
+  columns = arm64_replicate(columns, rec->esize, datasize);
+  if (columns != rec->value)
+    res->error = FIXTURE_ERROR_COLUMNS;
+  else if (!compare_input_imm_with_decoded_result(
+               rec->value, rec->n, rec->immr, rec->imms, datasize, res))
+    res->error = FIXTURE_ERROR_DECODED;
+  else if (!compare_input_imm_with_encoded_result(rec->value, rec->n,
+                                                  rec->immr, rec->imms,
+                                                  datasize))
+    res->error = FIXTURE_ERROR_ENCODED;
+  else if (!compare_input_imm_with_decoded_insn(rec->value, rec->n,
+                                                rec->immr, rec->imms,
+                                                datasize, &res->insn))
+    res->error = FIXTURE_ERROR_INSN;
+}
+
+/*
+ * Writes the report line of a checked record, a failed check prints its
+ * ERROR and exits.
+ */
+static void report_fixture_result(const struct arm64_fixture_record *rec,
+                                  const struct fixture_result *res) {
+  /* Columns are checked before decoding, there is no line for them */
+  if (res->error != FIXTURE_ERROR_COLUMNS)
+    report_decoded_result(rec->value, rec->n, rec->immr, rec->imms, res);
+
+  switch (res->error) {
+  case FIXTURE_OK:
+    return;
+  case FIXTURE_ERROR_COLUMNS:
+    report_printf("ERROR: fixture columns are not equal to value %lx\n",
+                  rec->value);
+    break;
+  case FIXTURE_ERROR_DECODED:
+    report_printf("ERROR: decoded result is not equal to expected value\n");
+    break;
+  case FIXTURE_ERROR_ENCODED:
+    report_printf("ERROR: encoded result is not equal to expected fields\n");
+    break;
+  case FIXTURE_ERROR_INSN:
+    report_printf("ERROR: decoded instruction %08x is not equal to expected\n",
+                  res->insn);
+    break;
+  case FIXTURE_ERROR_INVALID:
+    report_printf(
+        "ERROR: fixture value %lx is not a valid bitmask immediate\n",
+        rec->value);
+    break;
+  }
+  exit(1);
+}
+
+static void check_fixture_record(const struct arm64_fixture_record *rec,
+                                 uint32_t datasize) {
+  struct fixture_result res;
+
+  check_fixture_fields(rec, datasize, &res);
+  report_fixture_result(rec, &res);
+}
+
+/*
+ * Runs every batch kernel supported by the CPU over all immN:immr:imms
+ * values placed into ORR (immediate) words of both register widths and
+ * compares the results with arm64_disasm_logical_imm().
+ */
+static void check_batch_decode(void) {
+  static uint32_t insns[2 * ARM64_BIT_MASKS_TABLE_SIZE];
+  static uint64_t wmask[2 * ARM64_BIT_MASKS_TABLE_SIZE];
+  static uint8_t valid[2 * ARM64_BIT_MASKS_TABLE_SIZE];
+  static uint32_t insns2[2 * ARM64_BIT_MASKS_TABLE_SIZE];
+  static uint8_t valid2[2 * ARM64_BIT_MASKS_TABLE_SIZE];
+  struct arm64_logical_imm_insn expected;
+  arm64_bit_masks_batch_fn kernels[4];
+  uint32_t i;
+  int count, k;
+  bool is_decoded;
+
+  count = 0;
+  kernels[count++] = arm64_disasm_bit_masks_batch_scalar;
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2"))
+    kernels[count++] = arm64_disasm_bit_masks_batch_avx2;
+  if (__builtin_cpu_supports("avx512f"))
+    kernels[count++] = arm64_disasm_bit_masks_batch_avx512;
+#endif
+  kernels[count++] = arm64_disasm_bit_masks_batch;
+
+  /* orr <r>0, <r>1, #imm, W words with N = 1 are UNDEFINED */
+  for (i = 0; i < 2 * ARM64_BIT_MASKS_TABLE_SIZE; i++)
+    insns[i] = 0x32000020 | ((i >> 13) << 31) |
+               ((i & 0x1FFF) << ARM64_INSN_BIT_MASKS_SHIFT);
+
+  for (k = 0; k < count; k++) {
+    /* Odd length exercises the scalar tail of the vector kernels */
+    kernels[k](insns, 2 * ARM64_BIT_MASKS_TABLE_SIZE - 3, wmask, valid);
+    for (i = 0; i < 2 * ARM64_BIT_MASKS_TABLE_SIZE - 3; i++) {
+      is_decoded = arm64_disasm_logical_imm(insns[i], &expected);
+      if (valid[i] != is_decoded ||
+          (is_decoded && wmask[i] != expected.imm)) {
+        printf("ERROR: batch kernel %d differs at sf:immN:immr:imms %#x\n",
+               k, i);
+        exit(1);
+      }
+    }
+  }
+
+  /* orr <r>0, <r>zr, #imm of both register widths */
+  for (i = 0; i < 2 * ARM64_BIT_MASKS_TABLE_SIZE; i++)
+    insns2[i] = 0x320003e0 | ((i >> 13) << 31) |
+                ((i & 0x1FFF) << ARM64_INSN_BIT_MASKS_SHIFT);
+  arm64_move_wide_preferred_batch(insns2, 2 * ARM64_BIT_MASKS_TABLE_SIZE - 3,
+                                  valid2);
+  for (i = 0; i < 2 * ARM64_BIT_MASKS_TABLE_SIZE - 3; i++) {
+    if (valid2[i] != arm64_move_wide_preferred_table(
+                         i >> 13, (i >> 12) & 0x1, i & 0x3F, (i >> 6) & 0x3F)) {
+      printf("ERROR: move wide batch differs at sf:immN:immr:imms %#x\n", i);
+      exit(1);
+    }
+  }
+
+  printf("batch decode: %d kernels match\n", count);
+}
+
+/*
+ * Checks validity batch kernels against the encoder on every decoded
+ * value, values a bit or a shift away from them and random ones, for
+ * both register widths.
+ */
+#define CHECK_VALIDITY_VALUES (8 * ARM64_BIT_MASKS_TABLE_SIZE)
+
+static void check_batch_validity(void) {
+  static uint64_t vals[CHECK_VALIDITY_VALUES];
+  static uint8_t valid[CHECK_VALIDITY_VALUES];
+  arm64_bitmask_imm_batch_fn kernels[4];
+  uint64_t value, state;
+  uint32_t i;
+  int count, k, width;
+
+  count = 0;
+  kernels[count++] = arm64_is_bitmask_imm_batch_scalar;
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2"))
+    kernels[count++] = arm64_is_bitmask_imm_batch_avx2;
+  if (__builtin_cpu_supports("avx512f"))
+    kernels[count++] = arm64_is_bitmask_imm_batch_avx512;
 #endif
+  kernels[count++] = arm64_is_bitmask_imm_batch;
+
+  state = 0x9e3779b97f4a7c15ULL;
+  for (i = 0; i < CHECK_VALIDITY_VALUES; i++) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    value = arm64_bit_masks_table[i % ARM64_BIT_MASKS_TABLE_SIZE];
+    switch (i / ARM64_BIT_MASKS_TABLE_SIZE) {
+    case 0:
+      break;
+    case 1:
+      value ^= 1ULL << (state >> 58);
+      break;
+    case 2:
+      value <<= 1;
+      break;
+    case 3:
+      value = ~value;
+      break;
+    case 4:
+      value &= 0xffffffff;
+      break;
+    case 5:
+      value = (value & 0xffffffff) ^ (1ULL << (state >> 59));
+      break;
+    case 6:
+      value = state;
+      break;
+    default:
+      value = state & (state >> 17);
+      break;
+    }
+    vals[i] = value;
+  }
+
+  for (width = 32; width <= 64; width += 32) {
+    for (k = 0; k < count; k++) {
+      /* Odd length exercises the scalar tail of the vector kernels */
+      memset(valid, 0xff, sizeof(valid));
+      kernels[k](vals, CHECK_VALIDITY_VALUES - 5, valid, width);
+      for (i = 0; i < CHECK_VALIDITY_VALUES - 5; i++) {
+        if (valid[i] != arm64_is_bitmask_imm(vals[i], width)) {
+          printf("ERROR: validity kernel %d differs on %lx width %d\n", k,
+                 vals[i], width);
+          exit(1);
+        }
+      }
+    }
+  }
+
+  printf("batch validity: %d kernels match\n", count);
+}
+
+/*
+ * Every value of the fixture must be found valid by the batch API, with
+ * the -b check against the encoder this makes its valid set equal to the
+ * fixture.
+ */
+static void check_fixture_validity(const struct arm64_fixture_record *records,
+                                   uint64_t count, uint32_t datasize) {
+  uint64_t *vals;
+  uint8_t *valid;
+
+  vals = calloc(count, sizeof(*vals));
+  valid = malloc(count);
+  if (vals == NULL || valid == NULL) {
+    report_printf("malloc(): failed.");
+    exit(1);
   }
 
-  fclose(file);
-  if (line)
-    free(line);
+  for (uint64_t i = 0; i < count; i++)
+    vals[i] = records[i].value;
+  arm64_is_bitmask_imm_batch(vals, count, valid, datasize);
+  for (uint64_t i = 0; i < count; i++) {
+    if (!valid[i]) {
+      report_printf(
+          "ERROR: fixture value %lx is not a valid bitmask immediate\n",
+          vals[i]);
+      exit(1);
+    }
+  }
+
+  free(vals);
+  free(valid);
+}
+
+/* Checks records of a binary or the embedded fixture */
+static void check_fixture_records(const struct arm64_fixture_record *records,
+                                  uint64_t count, uint32_t datasize) {
+  for (uint64_t i = 0; i < count; i++)
+    check_fixture_record(&records[i], datasize);
+  check_fixture_validity(records, count, datasize);
+}
+
+/*
+ * Text fixture pipeline: reader -> parser -> decoder -> writer, one thread
+ * per stage, connected by bounded single-producer single-consumer rings.
+ * Blocks of the file and record batches circulate between neighbouring
+ * stages through a filled ring and a free ring, so nothing is allocated
+ * while running and the memory use doesn't grow with the input. A NULL
+ * item ends the stream. Every ring keeps FIFO order and every stage is a
+ * single thread, so the writer sees records in file order.
+ *
+ * The reader fills blocks with consecutive ranges of the file through one
+ * of the input backends below. The parser keeps a line cut by the end of
+ * a block and completes it from the next one. Errors travel with the
+ * batch to the writer, which reports everything before them, like the
+ * serial loop does.
+ */
+#define PIPELINE_RING_SIZE 16
+#define PIPELINE_BLOCK_SIZE (64 * 1024)
+#define PIPELINE_BLOCKS 8
+#define PIPELINE_BATCH_RECORDS 1024
+#define PIPELINE_BATCHES 8
+/* Longest fixture line carried over a block boundary */
+#define PIPELINE_LINE_MAX 256
+/* Busy polls of an empty or full ring before yielding the CPU */
+#define PIPELINE_SPINS 128
+
+_Static_assert((PIPELINE_RING_SIZE & (PIPELINE_RING_SIZE - 1)) == 0,
+               "ring size must be a power of 2");
+_Static_assert(PIPELINE_BLOCKS <= PIPELINE_RING_SIZE &&
+                   PIPELINE_BATCHES <= PIPELINE_RING_SIZE,
+               "free rings must hold the whole pool");
+
+/*
+ * Input backends of the streaming modes. Files are read as fixed ranges
+ * of block size in file order. io_uring keeps a queue of reads in flight
+ * on buffers registered once, so the device isn't left idle between two
+ * synchronous reads. pread() is the fallback where io_uring can't be set
+ * up: old kernels, or containers whose seccomp filter blocks it.
+ *
+ * The ring is driven by raw syscalls on the <linux/io_uring.h> layout,
+ * no liburing needed.
+ */
+enum input_backend {
+  INPUT_AUTO = 0,
+  INPUT_PREAD,
+  INPUT_URING,
+};
+
+/* Selected with `-i`, INPUT_AUTO tries io_uring first */
+static enum input_backend input_backend = INPUT_AUTO;
+
+struct input_uring {
+  int fd;
+  /* Buffers are registered, reads use IORING_OP_READ_FIXED */
+  bool fixed;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  /* Submission queue entries written but not passed to the kernel yet */
+  unsigned pending;
+  void *sq_map;
+  void *cq_map;
+  size_t sq_map_size;
+  size_t cq_map_size;
+  size_t sqes_size;
+};
+
+struct pipeline_ring {
+  void *items[PIPELINE_RING_SIZE];
+  /* Producer and consumer positions on separate cache lines */
+  _Alignas(64) uint64_t head;
+  _Alignas(64) uint64_t tail;
+};
+
+struct pipeline_block {
+  size_t len;
+  bool last;
+  /* Read completed, io_uring may complete blocks out of order */
+  bool done;
+  /* errno of a failed read, the block is the last one then */
+  int error;
+  char data[PIPELINE_BLOCK_SIZE];
+};
+
+struct pipeline_batch {
+  uint64_t count;
+  /* Malformed line (from 1) after the records, or 0 */
+  uint64_t error_line;
+  int read_error;
+  uint64_t values[PIPELINE_BATCH_RECORDS];
+  uint8_t valid[PIPELINE_BATCH_RECORDS];
+  struct arm64_fixture_record records[PIPELINE_BATCH_RECORDS];
+  struct fixture_result results[PIPELINE_BATCH_RECORDS];
+};
+
+struct pipeline {
+  int fd;
+  uint64_t size;
+  uint32_t datasize;
+  struct pipeline_ring filled_blocks;
+  struct pipeline_ring free_blocks;
+  struct pipeline_ring parsed;
+  struct pipeline_ring checked;
+  struct pipeline_ring free_batches;
+  struct pipeline_block blocks[PIPELINE_BLOCKS];
+  struct pipeline_batch batches[PIPELINE_BATCHES];
+  /* Owned by the reader, `uring.fd` is -1 for the pread() backend */
+  struct input_uring uring;
+  struct pipeline_block *inflight[PIPELINE_BLOCKS];
+  /* Line cut by the end of the previous block, owned by the parser */
+  char partial[PIPELINE_LINE_MAX];
+  size_t partial_len;
+};
+
+static void pipeline_backoff(uint32_t *spins) {
+  if (++*spins >= PIPELINE_SPINS) {
+    *spins = 0;
+    sched_yield();
+  }
+}
+
+static void pipeline_push(struct pipeline_ring *ring, void *item) {
+  uint64_t head;
+  uint32_t spins = 0;
+
+  head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) ==
+         PIPELINE_RING_SIZE)
+    pipeline_backoff(&spins);
+
+  ring->items[head % PIPELINE_RING_SIZE] = item;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void *pipeline_pop(struct pipeline_ring *ring) {
+  uint64_t tail;
+  uint32_t spins = 0;
+  void *item;
+
+  tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+    pipeline_backoff(&spins);
+
+  item = ring->items[tail % PIPELINE_RING_SIZE];
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  return (item);
+}
+
+/* Item of a free ring, which never carries the NULL end marker */
+static void *pipeline_try_pop(struct pipeline_ring *ring) {
+  uint64_t tail;
+  void *item;
+
+  tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+    return (NULL);
+
+  item = ring->items[tail % PIPELINE_RING_SIZE];
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  return (item);
+}
+
+static void input_uring_close(struct input_uring *u) {
+  if (u->sqes != NULL)
+    munmap(u->sqes, u->sqes_size);
+  if (u->cq_map != NULL && u->cq_map != u->sq_map)
+    munmap(u->cq_map, u->cq_map_size);
+  if (u->sq_map != NULL)
+    munmap(u->sq_map, u->sq_map_size);
+  close(u->fd);
+  memset(u, 0, sizeof(*u));
+  u->fd = -1;
+}
+
+/*
+ * Sets up a ring of `entries` reads and registers `nbufs` buffers of
+ * `buf_size` bytes. Registration may fail on RLIMIT_MEMLOCK, plain
+ * IORING_OP_READ is used then. Returns -1 if there is no io_uring.
+ */
+static int input_uring_open(struct input_uring *u, unsigned entries,
+                            char *const *bufs, unsigned nbufs,
+                            size_t buf_size) {
+  struct io_uring_params params;
+  struct iovec iov[PIPELINE_BLOCKS];
+  uint8_t *sq, *cq;
+
+  memset(u, 0, sizeof(*u));
+  memset(&params, 0, sizeof(params));
+  u->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (u->fd < 0)
+    return (-1);
+
+  u->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  u->cq_map_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_map_size > u->sq_map_size)
+      u->sq_map_size = u->cq_map_size;
+    u->cq_map_size = u->sq_map_size;
+  }
+  u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  u->sq_map = mmap(NULL, u->sq_map_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_map == MAP_FAILED) {
+    u->sq_map = NULL;
+    input_uring_close(u);
+    return (-1);
+  }
+  u->cq_map = u->sq_map;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    u->cq_map = mmap(NULL, u->cq_map_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+  u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->cq_map == MAP_FAILED || u->sqes == MAP_FAILED) {
+    u->cq_map = u->cq_map == MAP_FAILED ? NULL : u->cq_map;
+    u->sqes = u->sqes == MAP_FAILED ? NULL : u->sqes;
+    input_uring_close(u);
+    return (-1);
+  }
+
+  sq = u->sq_map;
+  cq = u->cq_map;
+  u->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  u->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  u->sq_array = (unsigned *)(sq + params.sq_off.array);
+  u->cq_head = (unsigned *)(cq + params.cq_off.head);
+  u->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  u->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  for (unsigned i = 0; i < nbufs; i++) {
+    iov[i].iov_base = bufs[i];
+    iov[i].iov_len = buf_size;
+  }
+  u->fixed = syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS,
+                     iov, nbufs) == 0;
+
+  return (0);
+}
+
+/* Queues a read of `buf`, which is registered buffer `index` */
+static void input_uring_read(struct input_uring *u, int fd, char *buf,
+                             unsigned index, size_t len, uint64_t offset,
+                             uint64_t user_data) {
+  struct io_uring_sqe *sqe;
+  unsigned tail, slot;
+
+  tail = *u->sq_tail;
+  slot = tail & *u->sq_mask;
+  sqe = &u->sqes[slot];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = u->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->buf_index = u->fixed ? index : 0;
+  sqe->user_data = user_data;
+  u->sq_array[slot] = slot;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  u->pending++;
+}
+
+/*
+ * Submits queued reads and waits for at least `wait` completions, which
+ * are passed to `fn` in completion order. Returns -1 on failure.
+ */
+static int input_uring_complete(struct input_uring *u, unsigned wait,
+                                void (*fn)(void *arg, uint64_t user_data,
+                                           int32_t res),
+                                void *arg) {
+  unsigned head, tail;
+  long ret;
+
+  while (u->pending > 0 || wait > 0) {
+    ret = syscall(__NR_io_uring_enter, u->fd, u->pending, wait,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret < 0)
+      return (-1);
+    u->pending -= ret;
+
+    head = *u->cq_head;
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      fn(arg, u->cqes[head & *u->cq_mask].user_data,
+         u->cqes[head & *u->cq_mask].res);
+      wait -= wait > 0;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  return (0);
+}
+
+/* Fills `buf` from `offset` up to `len` bytes, returns bytes read or -1 */
+static ssize_t input_pread(int fd, char *buf, size_t len, uint64_t offset) {
+  size_t done;
+  ssize_t got;
+
+  for (done = 0; done < len; done += got) {
+    got = pread(fd, buf + done, len - done, offset + done);
+    if (got < 0 && errno == EINTR) {
+      got = 0;
+      continue;
+    }
+    if (got < 0)
+      return (-1);
+    if (got == 0)
+      break;
+  }
+
+  return (done);
+}
+
+/* Block `seq` of the file, its length and whether it is the last one */
+static void pipeline_block_init(struct pipeline *pl,
+                                struct pipeline_block *block, uint64_t seq) {
+  uint64_t offset = seq * PIPELINE_BLOCK_SIZE;
+
+  block->len = pl->size - offset < PIPELINE_BLOCK_SIZE ? pl->size - offset
+                                                       : PIPELINE_BLOCK_SIZE;
+  block->last = offset + block->len == pl->size;
+  block->done = false;
+  block->error = 0;
+}
+
+static void pipeline_read_done(void *arg, uint64_t seq, int32_t res) {
+  struct pipeline *pl = arg;
+  struct pipeline_block *block;
+  ssize_t got;
+
+  block = pl->inflight[seq % PIPELINE_BLOCKS];
+  if (res < 0) {
+    block->error = -res;
+  } else if ((size_t)res < block->len) {
+    /* Short reads are rare, the rest is read synchronously */
+    got = input_pread(pl->fd, block->data + res, block->len - res,
+                      seq * PIPELINE_BLOCK_SIZE + res);
+    if (got < 0)
+      block->error = errno;
+    else if ((size_t)got < block->len - res)
+      block->error = EIO;
+  }
+  block->done = true;
+}
+
+/*
+ * Keeps up to PIPELINE_BLOCKS reads in flight and passes the blocks on in
+ * file order as they complete. The first free block is waited for, more
+ * are only taken while the parser has returned them.
+ */
+static void pipeline_read_uring(struct pipeline *pl, uint64_t nblocks) {
+  struct pipeline_block *block;
+  uint64_t submitted, pushed;
+
+  submitted = 0;
+  pushed = 0;
+  while (pushed < nblocks) {
+    while (submitted < nblocks && submitted - pushed < PIPELINE_BLOCKS) {
+      block = submitted == pushed ? pipeline_pop(&pl->free_blocks)
+                                  : pipeline_try_pop(&pl->free_blocks);
+      if (block == NULL)
+        break;
+      pipeline_block_init(pl, block, submitted);
+      pl->inflight[submitted % PIPELINE_BLOCKS] = block;
+      input_uring_read(&pl->uring, pl->fd, block->data, block - pl->blocks,
+                       block->len, submitted * PIPELINE_BLOCK_SIZE,
+                       submitted);
+      submitted++;
+    }
+
+    if (input_uring_complete(&pl->uring, 1, pipeline_read_done, pl) != 0) {
+      block = pl->inflight[pushed % PIPELINE_BLOCKS];
+      block->error = errno;
+      block->done = true;
+    }
+
+    while (pushed < submitted && pl->inflight[pushed % PIPELINE_BLOCKS]->done) {
+      block = pl->inflight[pushed++ % PIPELINE_BLOCKS];
+      if (block->error != 0)
+        block->last = true;
+      pipeline_push(&pl->filled_blocks, block);
+      if (block->last)
+        return;
+    }
+  }
+}
+
+static void pipeline_read_pread(struct pipeline *pl, uint64_t nblocks) {
+  struct pipeline_block *block;
+  ssize_t got;
+
+  for (uint64_t seq = 0; seq < nblocks; seq++) {
+    block = pipeline_pop(&pl->free_blocks);
+    pipeline_block_init(pl, block, seq);
+    got = input_pread(pl->fd, block->data, block->len,
+                      seq * PIPELINE_BLOCK_SIZE);
+    if (got < 0) {
+      block->error = errno;
+      block->last = true;
+    } else if ((size_t)got < block->len) {
+      /* The file was truncated while reading */
+      block->len = got;
+      block->last = true;
+    }
+    pipeline_push(&pl->filled_blocks, block);
+    if (block->last)
+      break;
+  }
+}
+
+static void *pipeline_reader(void *arg) {
+  struct pipeline *pl = arg;
+  uint64_t nblocks;
+
+  nblocks = (pl->size + PIPELINE_BLOCK_SIZE - 1) / PIPELINE_BLOCK_SIZE;
+  if (pl->uring.fd >= 0)
+    pipeline_read_uring(pl, nblocks);
+  else
+    pipeline_read_pread(pl, nblocks);
+
+  pipeline_push(&pl->filled_blocks, NULL);
+  return (NULL);
+}
+
+static struct pipeline_batch *pipeline_batch_get(struct pipeline *pl) {
+  struct pipeline_batch *batch;
+
+  batch = pipeline_pop(&pl->free_batches);
+  batch->count = 0;
+  batch->error_line = 0;
+  batch->read_error = 0;
+
+  return (batch);
+}
+
+/*
+ * Parses one line of [*p, end) into the current batch, which is passed on
+ * when full. Returns false and marks the batch if the line is malformed.
+ */
+static bool pipeline_parse_line(struct pipeline *pl,
+                                struct pipeline_batch **batch, const char **p,
+                                const char *end, uint64_t *line) {
+  if (*batch == NULL)
+    *batch = pipeline_batch_get(pl);
+
+  ++*line;
+  *p = arm64_fixture_parse_line(*p, end, pl->datasize,
+                                &(*batch)->records[(*batch)->count]);
+  if (*p == NULL) {
+    (*batch)->error_line = *line;
+    return (false);
+  }
+
+  if (++(*batch)->count == PIPELINE_BATCH_RECORDS) {
+    pipeline_push(&pl->parsed, *batch);
+    *batch = NULL;
+  }
+  return (true);
+}
+
+static void *pipeline_parser(void *arg) {
+  struct pipeline *pl = arg;
+  struct pipeline_block *block;
+  struct pipeline_batch *batch;
+  const char *p, *end, *tail, *nl, *partial;
+  uint64_t line;
+  size_t take;
+  bool failed;
+
+  line = 0;
+  batch = NULL;
+  failed = false;
+  while (!failed && (block = pipeline_pop(&pl->filled_blocks)) != NULL) {
+    p = block->data;
+    end = block->data + block->len;
+
+    /* Completes the line cut by the end of the previous block */
+    if (pl->partial_len > 0) {
+      nl = memchr(p, '\n', end - p);
+      take = nl == NULL ? (size_t)(end - p) : (size_t)(nl + 1 - p);
+      if (take > sizeof(pl->partial) - pl->partial_len)
+        take = sizeof(pl->partial) - pl->partial_len;
+      memcpy(pl->partial + pl->partial_len, p, take);
+      pl->partial_len += take;
+      p += take;
+      if (p < end && nl == NULL) {
+        /* Longer than any valid line, it fails to parse */
+        nl = p;
+      }
+      if (nl != NULL || block->last) {
+        partial = pl->partial;
+        failed = !pipeline_parse_line(pl, &batch, &partial,
+                                      pl->partial + pl->partial_len, &line);
+        pl->partial_len = 0;
+      }
+    }
+
+    /* Only the last block may end with a line without '\n' */
+    tail = end;
+    while (!block->last && tail > p && tail[-1] != '\n')
+      tail--;
+    while (p < tail && !failed)
+      failed = !pipeline_parse_line(pl, &batch, &p, tail, &line);
+
+    if (!failed && tail < end) {
+      take = end - tail;
+      if (take > sizeof(pl->partial))
+        take = sizeof(pl->partial);
+      memcpy(pl->partial, tail, take);
+      pl->partial_len = take;
+    }
+
+    if (block->error != 0) {
+      if (batch == NULL)
+        batch = pipeline_batch_get(pl);
+      batch->read_error = block->error;
+      failed = true;
+    }
+
+    /* After a failure the writer exits, the reader may stay blocked */
+    if (!failed)
+      pipeline_push(&pl->free_blocks, block);
+  }
+
+  /* Full batches went on in pipeline_parse_line(), this is the tail */
+  if (batch != NULL)
+    pipeline_push(&pl->parsed, batch);
+  pipeline_push(&pl->parsed, NULL);
+  return (NULL);
+}
+
+static void *pipeline_decoder(void *arg) {
+  struct pipeline *pl = arg;
+  struct pipeline_batch *batch;
+
+  while ((batch = pipeline_pop(&pl->parsed)) != NULL) {
+    for (uint64_t i = 0; i < batch->count; i++) {
+      check_fixture_fields(&batch->records[i], pl->datasize,
+                           &batch->results[i]);
+      batch->values[i] = batch->records[i].value;
+    }
+
+    arm64_is_bitmask_imm_batch(batch->values, batch->count, batch->valid,
+                               pl->datasize);
+    for (uint64_t i = 0; i < batch->count; i++) {
+      if (!batch->valid[i] && batch->results[i].error == FIXTURE_OK)
+        batch->results[i].error = FIXTURE_ERROR_INVALID;
+    }
+
+    pipeline_push(&pl->checked, batch);
+  }
+
+  pipeline_push(&pl->checked, NULL);
+  return (NULL);
+}
+
+/*
+ * Checks the text fixture at `path` through the pipeline, the calling
+ * thread is the writer. ERROR paths exit() like check_fixture_record().
+ */
+static int run_fixture_pipeline(const char *path, uint32_t datasize) {
+  void *(*const stages[])(void *) = {pipeline_reader, pipeline_parser,
+                                     pipeline_decoder};
+  pthread_t threads[sizeof(stages) / sizeof(stages[0])];
+  char *bufs[PIPELINE_BLOCKS];
+  struct pipeline_batch *batch;
+  struct pipeline *pl;
+  struct stat st;
+  int error;
+
+  pl = calloc(1, sizeof(*pl));
+  if (pl == NULL) {
+    report_printf("malloc(): failed.");
+    return (1);
+  }
+  pl->datasize = datasize;
+  pl->fd = open(path, O_RDONLY);
+  if (pl->fd < 0) {
+    report_printf("fopen(): failed.");
+    free(pl);
+    return (1);
+  }
+  pl->uring.fd = -1;
+  error = 1;
+  if (fstat(pl->fd, &st) != 0) {
+    report_printf("fstat(): failed.");
+    goto out;
+  }
+  pl->size = st.st_size;
+
+  for (int i = 0; i < PIPELINE_BLOCKS; i++)
+    bufs[i] = pl->blocks[i].data;
+  if (input_backend != INPUT_PREAD &&
+      input_uring_open(&pl->uring, PIPELINE_BLOCKS, bufs, PIPELINE_BLOCKS,
+                       PIPELINE_BLOCK_SIZE) != 0 &&
+      input_backend == INPUT_URING) {
+    report_printf("io_uring_setup(): failed.");
+    goto out;
+  }
+
+  for (int i = 0; i < PIPELINE_BLOCKS; i++)
+    pipeline_push(&pl->free_blocks, &pl->blocks[i]);
+  for (int i = 0; i < PIPELINE_BATCHES; i++)
+    pipeline_push(&pl->free_batches, &pl->batches[i]);
+  for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); i++) {
+    if (pthread_create(&threads[i], NULL, stages[i], pl) != 0) {
+      report_printf("pthread_create(): failed.");
+      exit(1);
+    }
+  }
+
+  while ((batch = pipeline_pop(&pl->checked)) != NULL) {
+    for (uint64_t i = 0; i < batch->count; i++)
+      report_fixture_result(&batch->records[i], &batch->results[i]);
+    if (batch->error_line != 0) {
+      report_printf("ERROR: malformed fixture line %lu\n", batch->error_line);
+      exit(1);
+    }
+    if (batch->read_error != 0) {
+      report_printf("read(): failed.");
+      exit(1);
+    }
+    pipeline_push(&pl->free_batches, batch);
+  }
+
+  for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+    pthread_join(threads[i], NULL);
+  error = 0;
+
+out:
+  if (pl->uring.fd >= 0)
+    input_uring_close(&pl->uring);
+  close(pl->fd);
+  free(pl);
+
+  return (error);
+}
+
+/*
+ * Checks every kernel variant against the reference loop/shift one on
+ * all inputs the decoder can produce, plus random values for
+ * arm64_highest_set_bit().
+ */
+static void check_variants(void) {
+  uint64_t value, state, expected;
+  uint32_t esize, r;
+  int bit_count;
+  size_t i, k;
+
+  state = 0x2545f4914f6cdd1dULL;
+  for (k = 0; k < ARM64_NITEMS(arm64_highest_set_bit_variants); k++) {
+    for (i = 0; i < (1 << 16); i++) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      value = i < 128 ? i : state >> (i & 0x3F);
+      if (arm64_highest_set_bit_variants[k].fn(value) !=
+          arm64_highest_set_bit_loop(value)) {
+        printf("ERROR: highest set bit variant %s differs on %lx\n",
+               arm64_highest_set_bit_variants[k].name, value);
+        exit(1);
+      }
+    }
+  }
+
+  for (esize = 2; esize <= 64; esize *= 2) {
+    for (i = 0; i < (1 << 12); i++) {
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      value = (esize <= 8 ? i : state) & arm64_ones(esize);
+
+      for (bit_count = 32; bit_count <= 64; bit_count += 32) {
+        if (esize > (uint32_t)bit_count)
+          continue;
+        expected = arm64_replicate_loop(value, esize, bit_count);
+        for (k = 0; k < ARM64_NITEMS(arm64_replicate_variants); k++) {
+          if (arm64_replicate_variants[k].fn(value, esize, bit_count) !=
+              expected) {
+            printf("ERROR: replicate variant %s differs on %lx/%u\n",
+                   arm64_replicate_variants[k].name, value, esize);
+            exit(1);
+          }
+        }
+      }
+
+      r = i % esize;
+      expected = arm64_ror_shift(value, r, esize);
+      for (k = 0; k < ARM64_NITEMS(arm64_ror_variants); k++) {
+        if (arm64_ror_variants[k].fn(value, r, esize) != expected) {
+          printf("ERROR: ror variant %s differs on %lx/%u/%u\n",
+                 arm64_ror_variants[k].name, value, r, esize);
+          exit(1);
+        }
+      }
+    }
+  }
+
+#if defined(ARM64_VARIANTS_IFUNC)
+  printf("variants consistent, selected:");
+  for (k = 0; k < ARM64_NITEMS(arm64_highest_set_bit_variants); k++) {
+    if (arm64_highest_set_bit_variants[k].fn ==
+        arm64_highest_set_bit_resolve())
+      printf(" highest_set_bit=%s", arm64_highest_set_bit_variants[k].name);
+  }
+  for (k = 0; k < ARM64_NITEMS(arm64_replicate_variants); k++) {
+    if (arm64_replicate_variants[k].fn == arm64_replicate_resolve())
+      printf(" replicate=%s", arm64_replicate_variants[k].name);
+  }
+  for (k = 0; k < ARM64_NITEMS(arm64_ror_variants); k++) {
+    if (arm64_ror_variants[k].fn == arm64_ror_resolve())
+      printf(" ror=%s", arm64_ror_variants[k].name);
+  }
+#else
+  printf("variants consistent, selected: portable");
+#endif
+  printf("\n");
+}
+
+/*
+ * A single MOVZ or MOVN gives `value` if it or its inversion has at most
+ * one non-zero halfword in `datasize` bits.
+ */
+static bool reference_move_wide(uint64_t value, uint32_t datasize) {
+  int used = 0, unused = 0;
+
+  for (uint32_t hw = 0; hw < datasize; hw += 16) {
+    used += ((value >> hw) & 0xFFFF) != 0;
+    unused += ((value >> hw) & 0xFFFF) != 0xFFFF;
+  }
+
+  return (used <= 1 || unused <= 1);
+}
+
+/*
+ * Independent model of DecodeBitMasks() from the Arm ARM for `datasize`
+ * bit registers: element length is found scanning from lsb and every
+ * result bit is computed separately instead of rotating and replicating.
+ * `tmask` may be NULL.
+ */
+static bool reference_bit_masks(uint32_t n, uint32_t imms, uint32_t immr,
+                                bool logical_imm, uint32_t datasize,
+                                uint64_t *wmask, uint64_t *tmask) {
+  uint32_t combined, esize, levels, s, r, d, bit;
+  int length;
+
+  combined = (n << 6) | (~imms & 0x3F);
+  length = -1;
+  for (bit = 0; bit < 7; bit++) {
+    if (combined & (1U << bit))
+      length = bit;
+  }
+
+  if (length < 1)
+    return (false);
+  esize = 1U << length;
+  if (esize > datasize)
+    return (false);
+
+  levels = esize - 1;
+  s = imms & levels;
+  r = immr & levels;
+  if (logical_imm && s == levels)
+    return (false);
+
+  *wmask = 0;
+  for (bit = 0; bit < datasize; bit++) {
+    /* Bit of the element before rotation right by r */
+    if (((bit % esize) + r) % esize <= s)
+      *wmask |= 1ULL << bit;
+  }
+
+  if (tmask != NULL) {
+    d = (s + esize - r) % esize;
+    *tmask = 0;
+    for (bit = 0; bit < datasize; bit++) {
+      if (bit % esize <= d)
+        *tmask |= 1ULL << bit;
+    }
+  }
+
+  return (true);
+}
+
+/* sf:logical_imm:immN:immr:imms */
+#define EXHAUSTIVE_CASES (2 * 2 * ARM64_BIT_MASKS_TABLE_SIZE)
+#define EXHAUSTIVE_MAX_THREADS 64
+
+struct exhaustive_result {
+  uint32_t first;
+  uint32_t last;
+  uint64_t checked;
+  uint64_t defined;
+  uint64_t rejected;
+  uint64_t mismatches;
+  /* Lowest failing case, or EXHAUSTIVE_CASES */
+  uint32_t first_mismatch;
+};
+
+static bool exhaustive_check_case(uint32_t index, bool *defined) {
+  struct arm64_logical_imm_insn decoded;
+  uint32_t sf, n, immr, imms, insn, wmask32 = 0, table32 = 0;
+  uint64_t expected = 0, wmask = 0, table = 0;
+  uint64_t expected_tmask = 0, tmask_wmask = 0, tmask = 0;
+  bool logical_imm, is_expected, is_decoded, is_table, preferred;
+  uint32_t datasize;
+
+  sf = (index >> 14) & 0x1;
+  logical_imm = (index >> 13) & 0x1;
+  n = (index >> 12) & 0x1;
+  immr = (index >> 6) & 0x3F;
+  imms = index & 0x3F;
+
+  datasize = sf == 1 ? 64 : 32;
+  is_expected = reference_bit_masks(n, imms, immr, logical_imm, datasize,
+                                    &expected, &expected_tmask);
+  *defined = is_expected;
+
+  /* Freestanding decoder is width aware itself */
+  is_decoded = arm64_kern_disasm_bit_masks(n, imms, immr, logical_imm,
+                                           datasize, &wmask);
+  if (is_decoded != is_expected || (is_expected && wmask != expected))
+    return (false);
+
+  if (logical_imm) {
+    /* orr <r>0, <r>1, #imm, the only path aware of the register width */
+    insn = 0x32000020 | (sf << 31) | (n << 22) | (immr << 16) | (imms << 10);
+    is_decoded = arm64_disasm_logical_imm(insn, &decoded);
+    if (is_decoded != is_expected ||
+        (is_decoded && decoded.imm != expected))
+      return (false);
+
+    /* The formula is only defined for valid encodings, the table is 0 */
+    preferred = is_expected && reference_move_wide(expected, datasize);
+    if ((is_expected &&
+         (arm64_move_wide_preferred(sf, n, imms, immr) != preferred ||
+          arm64_kern_move_wide_preferred(sf, n, imms, immr) != preferred)) ||
+        arm64_move_wide_preferred_table(sf, n, imms, immr) != preferred)
+      return (false);
+  }
+
+  /*
+   * W register decoders must reject 64 bit element themselves, 64 bit
+   * decoders must give the replicated 32 bit value for other encodings.
+   */
+  if (sf == 0) {
+    is_decoded =
+        arm64_disasm_bit_masks32(n, imms, immr, logical_imm, &wmask32);
+    is_table =
+        arm64_disasm_bit_masks32_table(n, imms, immr, logical_imm, &table32);
+    if (is_decoded != is_expected || is_table != is_expected ||
+        (is_expected && (wmask32 != expected || table32 != expected)))
+      return (false);
+    if (n == 1)
+      return (true);
+  }
+
+  is_decoded = arm64_disasm_bit_masks(n, imms, immr, logical_imm, &wmask);
+  is_table = arm64_disasm_bit_masks_table(n, imms, immr, logical_imm, &table);
+  if (is_decoded != is_expected || is_table != is_expected ||
+      arm64_disasm_bit_masks_tmask(n, imms, immr, logical_imm, &tmask_wmask,
+                                   &tmask) != is_expected)
+    return (false);
+  if (!is_expected)
+    return (true);
+  if (sf == 0) {
+    expected |= expected << 32;
+    expected_tmask |= expected_tmask << 32;
+  }
+
+  return (wmask == expected && table == expected &&
+          tmask_wmask == expected && tmask == expected_tmask);
+}
+
+static void *exhaustive_worker(void *arg) {
+  struct exhaustive_result *result = arg;
+  bool defined;
+
+  for (uint32_t i = result->first; i < result->last; i++) {
+    result->checked++;
+    if (!exhaustive_check_case(i, &defined)) {
+      if (result->mismatches++ == 0)
+        result->first_mismatch = i;
+    }
+    if (defined)
+      result->defined++;
+    else
+      result->rejected++;
+  }
+
+  return (NULL);
+}
+
+/*
+ * Checks decoders against reference_bit_masks() for every sf, logical_imm
+ * and immN:immr:imms. Cases are split into contiguous ranges, one per
+ * thread, and summed in range order so output doesn't depend on timing.
+ */
+static int run_exhaustive(long nthreads) {
+  struct exhaustive_result results[EXHAUSTIVE_MAX_THREADS];
+  pthread_t threads[EXHAUSTIVE_MAX_THREADS];
+  struct exhaustive_result total;
+  bool started[EXHAUSTIVE_MAX_THREADS];
+  uint32_t first_mismatch, sf, n, immr, imms;
+
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > EXHAUSTIVE_MAX_THREADS)
+    nthreads = EXHAUSTIVE_MAX_THREADS;
+
+  for (long i = 0; i < nthreads; i++) {
+    memset(&results[i], 0, sizeof(results[i]));
+    results[i].first = EXHAUSTIVE_CASES * i / nthreads;
+    results[i].last = EXHAUSTIVE_CASES * (i + 1) / nthreads;
+    results[i].first_mismatch = EXHAUSTIVE_CASES;
+    started[i] = i > 0 && pthread_create(&threads[i], NULL,
+                                         exhaustive_worker, &results[i]) == 0;
+  }
+  exhaustive_worker(&results[0]);
+
+  memset(&total, 0, sizeof(total));
+  first_mismatch = EXHAUSTIVE_CASES;
+  for (long i = 0; i < nthreads; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else if (i > 0)
+      exhaustive_worker(&results[i]);
+    total.checked += results[i].checked;
+    total.defined += results[i].defined;
+    total.rejected += results[i].rejected;
+    total.mismatches += results[i].mismatches;
+    if (results[i].first_mismatch < first_mismatch)
+      first_mismatch = results[i].first_mismatch;
+  }
+
+  printf("exhaustive: checked: %lu, defined: %lu, rejected: %lu, "
+         "mismatches: %lu\n",
+         total.checked, total.defined, total.rejected, total.mismatches);
+  if (total.mismatches == 0)
+    return (0);
+
+  sf = (first_mismatch >> 14) & 0x1;
+  n = (first_mismatch >> 12) & 0x1;
+  immr = (first_mismatch >> 6) & 0x3F;
+  imms = first_mismatch & 0x3F;
+  printf("ERROR: first mismatch sf: %u logical_imm: %u immn: %u immr: %u "
+         "imms: %u\n",
+         sf, (first_mismatch >> 13) & 0x1, n, immr, imms);
+  return (1);
+}
+
+/*
+ * <T> straight from the encoding table of the SVE bitmask immediates.
+ */
+static uint32_t reference_sve_esize(uint32_t n, uint32_t imms) {
+  if (n == 1)
+    return (64);
+  if ((imms & 0x20) == 0)
+    return (32);
+  if ((imms & 0x30) == 0x20)
+    return (16);
+  if ((imms & 0x3E) != 0x3E)
+    return (8);
+
+  return (0);
+}
+
+/*
+ * Brute force of DUP (immediate): any imm8, shifted by 0 or 8, sign
+ * extended to an element and replicated.
+ */
+static bool reference_sve_dup_imm(uint64_t imm) {
+  uint64_t elem;
+
+  for (uint32_t esize = 8; esize <= 64; esize *= 2) {
+    for (int imm8 = -128; imm8 < 128; imm8++) {
+      for (int shift = 0; shift <= (esize > 8 ? 8 : 0); shift += 8) {
+        elem = (uint64_t)(int64_t)(imm8 * (1 << shift)) & arm64_ones(esize);
+        if (arm64_replicate_loop(elem, esize, 64) == imm)
+          return (true);
+      }
+    }
+  }
+
+  return (false);
+}
+
+/*
+ * Decodes every imm13 of every SVE bitmask immediate op, assembles the
+ * value back and fills registers of every vector length with it.
+ */
+static int check_sve_bitmask(void) {
+  uint8_t buf[ARM64_SVE_VL_MAX / 8];
+  struct arm64_sve_bitmask_imm_insn decoded, again;
+  uint32_t imm13, op, n, immr, imms, insn, reinsn, vl, defined;
+  uint64_t expected = 0;
+  bool is_expected, is_decoded;
+
+  defined = 0;
+  for (imm13 = 0; imm13 < ARM64_BIT_MASKS_TABLE_SIZE; imm13++) {
+    n = imm13 >> 12;
+    immr = (imm13 >> 6) & 0x3F;
+    imms = imm13 & 0x3F;
+    is_expected =
+        reference_bit_masks(n, imms, immr, true, 64, &expected, NULL);
+
+    for (op = ARM64_SVE_ORR; op <= ARM64_SVE_DUPM; op++) {
+      insn = ARM64_SVE_BITMASK_IMM_VALUE | (op << 22) |
+             (imm13 << ARM64_SVE_IMM13_SHIFT) | (imm13 & 0x1F);
+      is_decoded = arm64_disasm_sve_bitmask_imm(insn, &decoded);
+      if (is_decoded != is_expected ||
+          arm64_disasm_sve_bitmask_imm(insn | 0x00040000, &again))
+        goto mismatch;
+      if (!is_decoded)
+        continue;
+      defined++;
+
+      if (decoded.imm != expected || decoded.op != op ||
+          decoded.zd != (imm13 & 0x1F) ||
+          decoded.esize != reference_sve_esize(n, imms) ||
+          (decoded.alias == ARM64_SVE_ALIAS_MOV) !=
+              (op == ARM64_SVE_DUPM && !reference_sve_dup_imm(expected)))
+        goto mismatch;
+
+      /* Encoder picks the canonical immr, the value must survive */
+      if (!arm64_asm_sve_bitmask_imm(op, decoded.esize,
+                                     expected & arm64_ones(decoded.esize),
+                                     decoded.zd, &reinsn) ||
+          !arm64_disasm_sve_bitmask_imm(reinsn, &again) ||
+          again.imm != expected || again.op != op || again.zd != decoded.zd)
+        goto mismatch;
+
+      for (vl = ARM64_SVE_VL_MIN; vl <= ARM64_SVE_VL_MAX; vl += 128) {
+        memset(buf, 0, sizeof(buf));
+        if (!arm64_sve_bitmask_fill(expected, vl, buf))
+          goto mismatch;
+        for (uint32_t i = 0; i < sizeof(buf); i++) {
+          if (buf[i] != (i < vl / 8 ? (uint8_t)(expected >> (i % 8 * 8)) : 0))
+            goto mismatch;
+        }
+      }
+    }
+  }
+
+  if (arm64_sve_bitmask_fill(0x5555555555555555, 192, buf) ||
+      arm64_sve_bitmask_fill(0x5555555555555555, 2176, buf)) {
+    printf("ERROR: SVE fill accepted invalid vector length\n");
+    return (1);
+  }
+
+  printf("sve bitmask: checked: %u, defined: %u, mismatches: 0\n",
+         ARM64_BIT_MASKS_TABLE_SIZE * 4, defined);
+  return (0);
+
+mismatch:
+  printf("ERROR: SVE bitmask immediate mismatch op: %u imm13: %#x\n", op,
+         imm13);
+  return (1);
+}
+
+/*
+ * Alias of a bitfield move written from the alias list of the Arm ARM,
+ * extensions are tested by their fields rather than by BFXPreferred().
+ */
+static enum arm64_bitfield_alias
+reference_bitfield_alias(uint32_t sf, uint32_t opc, uint32_t imms,
+                         uint32_t immr, uint32_t rn) {
+  uint32_t last = sf == 1 ? 63 : 31;
+  bool ext = immr == 0 && (imms == 7 || imms == 15);
+
+  switch (opc) {
+  case ARM64_BITFIELD_SBFM:
+    if (imms == last)
+      return (ARM64_BITFIELD_ALIAS_ASR);
+    if (imms < immr)
+      return (ARM64_BITFIELD_ALIAS_SBFIZ);
+    if (ext || (sf == 1 && immr == 0 && imms == 31))
+      return (imms == 7    ? ARM64_BITFIELD_ALIAS_SXTB
+              : imms == 15 ? ARM64_BITFIELD_ALIAS_SXTH
+                           : ARM64_BITFIELD_ALIAS_SXTW);
+    return (ARM64_BITFIELD_ALIAS_SBFX);
+  case ARM64_BITFIELD_BFM:
+    /* BFC #0 can't have imms < immr, it is BFXIL with immr 0 instead */
+    if (rn == ARM64_REG_ZR && (imms < immr || immr == 0))
+      return (ARM64_BITFIELD_ALIAS_BFC);
+    if (imms < immr)
+      return (ARM64_BITFIELD_ALIAS_BFI);
+    return (ARM64_BITFIELD_ALIAS_BFXIL);
+  default:
+    if (imms + 1 == immr)
+      return (ARM64_BITFIELD_ALIAS_LSL);
+    if (imms == last)
+      return (ARM64_BITFIELD_ALIAS_LSR);
+    if (imms < immr)
+      return (ARM64_BITFIELD_ALIAS_UBFIZ);
+    /* UXTB and UXTH have no X register form, UBFX is used there */
+    if (ext && sf == 0)
+      return (imms == 7 ? ARM64_BITFIELD_ALIAS_UXTB
+                        : ARM64_BITFIELD_ALIAS_UXTH);
+    return (ARM64_BITFIELD_ALIAS_UBFX);
+  }
+}
+
+/*
+ * Decodes every sf:opc:N:immr:imms with Rn = X0 and ZR. Masks come from
+ * reference_bit_masks(), and UBFM executed by them must equal the
+ * extract or insert its #lsb and #width describe.
+ */
+static int check_bitfield(void) {
+  static const uint64_t sources[] = {0x0123456789abcdef, 0xfedcba9876543210,
+                                     0x8000000000000001};
+  struct arm64_bitfield_insn decoded;
+  uint32_t sf, opc, n, immr, imms, rn, insn, datasize, checked, defined;
+  uint64_t wmask = 0, tmask = 0, src, rotated, result, expected;
+  bool is_expected;
+
+  checked = defined = 0;
+  for (insn = 0; insn < 1U << 17; insn++) {
+    sf = insn >> 16;
+    opc = (insn >> 14) & 0x3;
+    n = (insn >> 13) & 0x1;
+    rn = insn & 0x1000 ? ARM64_REG_ZR : 0;
+    immr = (insn >> 6) & 0x3F;
+    imms = insn & 0x3F;
+    datasize = sf == 1 ? 64 : 32;
+    checked++;
+
+    is_expected = opc != 3 && n == sf && immr < datasize && imms < datasize;
+    if (arm64_disasm_bitfield(ARM64_BITFIELD_VALUE | sf << 31 | opc << 29 |
+                                  n << 22 | immr << 16 | imms << 10 |
+                                  rn << 5 | 0x1,
+                              &decoded) != is_expected)
+      goto mismatch;
+    if (!is_expected)
+      continue;
+    defined++;
+
+    if (!reference_bit_masks(n, imms, immr, false, datasize, &wmask, &tmask) ||
+        decoded.wmask != wmask || decoded.tmask != tmask ||
+        decoded.op != opc || decoded.sf != sf || decoded.rd != 0x1 ||
+        decoded.rn != rn || decoded.immr != immr || decoded.imms != imms ||
+        decoded.alias != reference_bitfield_alias(sf, opc, imms, immr, rn))
+      goto mismatch;
+
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+      src = sources[i] & arm64_ones(datasize);
+      rotated = arm64_ror_shift(src, immr, datasize);
+      result = rotated & wmask & tmask;
+      if (imms < immr)
+        expected = (src & arm64_ones(decoded.width)) << decoded.lsb;
+      else
+        expected = (src >> decoded.lsb) & arm64_ones(decoded.width);
+      if (result != (expected & arm64_ones(datasize)))
+        goto mismatch;
+    }
+  }
+
+  printf("bitfield: checked: %u, defined: %u, mismatches: 0\n", checked,
+         defined);
+  return (0);
+
+mismatch:
+  printf("ERROR: bitfield mismatch sf: %u opc: %u immn: %u immr: %u "
+         "imms: %u rn: %u\n",
+         sf, opc, n, immr, imms, rn);
+  return (1);
+}
+
+/*
+ * Runs a constant plan: MOVZ, MOVN, MOVK and ORR, EOR (immediate) of X
+ * registers. Every instruction must write `rd`, ORR starts from XZR and
+ * EOR reads `rd` back.
+ */
+static bool plan_execute(const struct arm64_constant_plan *plan, uint32_t rd,
+                         uint64_t *result) {
+  struct arm64_logical_imm_insn logical;
+  uint64_t value = 0, imm16;
+  uint32_t insn, hw;
+
+  for (uint32_t i = 0; i < plan->count; i++) {
+    insn = plan->insns[i];
+    if ((insn & 0x1F) != rd)
+      return (false);
+
+    if ((insn & 0xff800000) == ARM64_MOVN_X ||
+        (insn & 0xff800000) == ARM64_MOVZ_X ||
+        (insn & 0xff800000) == ARM64_MOVK_X) {
+      hw = (insn >> 21) & 0x3;
+      imm16 = (uint64_t)((insn >> 5) & 0xFFFF) << (hw * 16);
+      if ((insn & 0xff800000) == ARM64_MOVK_X)
+        value = (value & ~(0xFFFFULL << (hw * 16))) | imm16;
+      else if ((insn & 0xff800000) == ARM64_MOVZ_X)
+        value = imm16;
+      else
+        value = ~imm16;
+      if (i > 0 && (insn & 0xff800000) != ARM64_MOVK_X)
+        return (false);
+    } else if (arm64_disasm_logical_imm(insn, &logical) && logical.sf == 1) {
+      if (logical.op == ARM64_LOGICAL_ORR && logical.rn == ARM64_REG_ZR)
+        value = logical.imm;
+      else if (logical.op == ARM64_LOGICAL_EOR && logical.rn == rd && i > 0)
+        value ^= logical.imm;
+      else
+        return (false);
+    } else {
+      return (false);
+    }
+  }
+
+  *result = value;
+  return (plan->count > 0);
+}
+
+/*
+ * Plans constants of known shapes and checks the plans build them within
+ * the instruction count the shape needs, random values need at most 4.
+ */
+static int check_constant_plans(void) {
+  struct arm64_constant_plan plan;
+  uint64_t value, result = 0, state, counts[ARM64_PLAN_MAX_INSNS + 1];
+  uint32_t shape, expected, rd, n, immr, imms;
+  uint64_t i, bitmask;
+
+  memset(counts, 0, sizeof(counts));
+  state = 0x853c49e6748fea9bULL;
+  for (i = 0; i < (1 << 22); i++) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    bitmask = arm64_bit_masks_table[(state >> 20) % ARM64_BIT_MASKS_TABLE_SIZE];
+    rd = (state >> 40) % 31;
+    shape = i % 6;
+
+    switch (shape) {
+    case 0:
+      /* MOVZ or MOVN */
+      value = ((state >> 48) & 0xFFFF) << ((state >> 16) % 4 * 16);
+      value = state & 0x1 ? ~value : value;
+      expected = 1;
+      break;
+    case 1:
+      /* Any bitmask immediate, 0 and all-ones are MOVZ and MOVN */
+      value = bitmask;
+      expected = 1;
+      break;
+    case 2:
+      /* Two halfwords, either zeros or ones elsewhere */
+      value = ((state >> 48) & 0xFFFF) | ((state >> 8) & 0xFFFF) << 32;
+      value = state & 0x1 ? ~value : value;
+      expected = 2;
+      break;
+    case 3:
+      /* Bitmask with one halfword replaced */
+      value = bitmask & ~(0xFFFFULL << ((state >> 16) % 4 * 16));
+      value |= ((state >> 32) & 0xFFFF) << ((state >> 16) % 4 * 16);
+      expected = 2;
+      break;
+    case 4:
+      /* Run of ones with a bitmask immediate flipped inside */
+      value = arm64_ones((state >> 8) % 64 + 1) << ((state >> 16) % 64);
+      value = arm64_plan_span(value) ^ (bitmask & arm64_plan_span(value));
+      expected = arm64_encode_bit_masks(arm64_plan_span(value) ^ value, &n,
+                                        &immr, &imms)
+                     ? 2
+                     : ARM64_PLAN_MAX_INSNS;
+      break;
+    default:
+      value = state ^ (state >> 29);
+      expected = ARM64_PLAN_MAX_INSNS;
+      break;
+    }
+
+    if (arm64_plan_constant(value, rd, &plan) > expected ||
+        !plan_execute(&plan, rd, &result) || result != value) {
+      printf("ERROR: constant plan of %lx (shape %u) takes %u "
+             "instructions, builds %lx\n",
+             value, shape, plan.count, result);
+      return (1);
+    }
+    counts[plan.count]++;
+  }
+
+  printf("constant plans: checked: %lu, instructions: 1: %lu, 2: %lu, "
+         "3: %lu, 4: %lu\n",
+         i, counts[1], counts[2], counts[3], counts[4]);
+  return (0);
+}
+
+/*
+ * Corpus generator, enumerates every valid (esize, length, rotation) of
+ * `datasize` bit logical immediates in the order of the text fixture and
+ * emits both all_possible_bitmask_imm.txt and generate.txt lines.
+ * Element sizes are generated in parallel into their own buffers which
+ * are then written in order.
+ */
+#define GENERATE_TASKS 6
+/* "size=02 length=00 rotation=00 N=0 immr=000000 imms=000000\n" */
+#define GENERATE_FIXTURE_COLUMNS 60
+/* "\torr\twsp, w1, #0x\n" */
+#define GENERATE_ASM_COLUMNS 19
+
+struct generate_task {
+  uint32_t esize;
+  uint32_t datasize;
+  char *fixture;
+  size_t fixture_len;
+  char *assembly;
+  size_t assembly_len;
+};
+
+static char *generate_format_digits(char *p, uint64_t value, int count,
+                                    int bits) {
+  static const char digits[] = "0123456789abcdef";
+
+  for (int i = count - 1; i >= 0; i--) {
+    p[i] = digits[value & ((1 << bits) - 1)];
+    value >>= bits;
+  }
+
+  return (p + count);
+}
+
+static char *generate_format_dec2(char *p, uint32_t value) {
+  p[0] = '0' + value / 10 % 10;
+  p[1] = '0' + value % 10;
+
+  return (p + 2);
+}
+
+static void *generate_worker(void *arg) {
+  struct generate_task *task = arg;
+  uint32_t esize, length, rotation, immr, imms, n;
+  uint64_t value, lines;
+  char *f, *a;
+
+  esize = task->esize;
+  lines = (uint64_t)esize * (esize - 1);
+  task->fixture = malloc(lines * (task->datasize / 4 + task->datasize + 2 +
+                                  GENERATE_FIXTURE_COLUMNS));
+  task->assembly = malloc(lines * (task->datasize / 4 + GENERATE_ASM_COLUMNS));
+  if (task->fixture == NULL || task->assembly == NULL)
+    return (NULL);
+
+  f = task->fixture;
+  a = task->assembly;
+  for (length = 0; length < esize - 1; length++) {
+    for (rotation = 0; rotation < esize; rotation++) {
+      value = arm64_ror(arm64_ones(length + 1), rotation, esize);
+      value = arm64_replicate(value, esize, task->datasize);
+
+      n = esize == 64;
+      immr = rotation;
+      imms = (~(esize * 2 - 1) & 0x3F) | length;
+
+      f = generate_format_digits(f, value, task->datasize / 4, 4);
+      f = report_format_lit(f, " ");
+      f = generate_format_digits(f, value, task->datasize, 1);
+      f = report_format_lit(f, " size=");
+      f = generate_format_dec2(f, esize);
+      f = report_format_lit(f, " length=");
+      f = generate_format_dec2(f, length);
+      f = report_format_lit(f, " rotation=");
+      f = generate_format_dec2(f, rotation);
+      f = report_format_lit(f, " N=");
+      f = generate_format_digits(f, n, 1, 1);
+      f = report_format_lit(f, " immr=");
+      f = generate_format_digits(f, immr, 6, 1);
+      f = report_format_lit(f, " imms=");
+      f = generate_format_digits(f, imms, 6, 1);
+      f = report_format_lit(f, "\n");
+
+      if (task->datasize == 64)
+        a = report_format_lit(a, "\torr\tsp, x1, #0x");
+      else
+        a = report_format_lit(a, "\torr\twsp, w1, #0x");
+      a = report_format_hex(a, value);
+      a = report_format_lit(a, "\n");
+    }
+  }
+
+  task->fixture_len = f - task->fixture;
+  task->assembly_len = a - task->assembly;
+  return (NULL);
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+  ssize_t written;
+
+  while (len > 0) {
+    written = write(fd, buf, len);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0)
+      return (-1);
+    buf += written;
+    len -= written;
+  }
+
+  return (0);
+}
+
+/*
+ * Writes `fixture_path` and `assembly_path` for `datasize` (32 or 64)
+ * bit registers. The fixture has no newline after the last line.
+ */
+static int generate_corpus(const char *fixture_path, const char *assembly_path,
+                           uint32_t datasize, long nthreads) {
+  struct generate_task tasks[GENERATE_TASKS];
+  pthread_t threads[GENERATE_TASKS];
+  bool started[GENERATE_TASKS];
+  int ntasks, fixture_fd, assembly_fd, error;
+
+  ntasks = 0;
+  for (uint32_t esize = 2; esize <= datasize; esize *= 2) {
+    memset(&tasks[ntasks], 0, sizeof(tasks[ntasks]));
+    tasks[ntasks].esize = esize;
+    tasks[ntasks].datasize = datasize;
+    ntasks++;
+  }
+
+  /* Largest elements take most of the time, they go to threads first */
+  for (int i = ntasks - 1; i >= 0; i--) {
+    started[i] = i > 0 && ntasks - i < nthreads &&
+                 pthread_create(&threads[i], NULL, generate_worker,
+                                &tasks[i]) == 0;
+    if (!started[i])
+      generate_worker(&tasks[i]);
+  }
+
+  error = 0;
+  for (int i = 0; i < ntasks; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    if (tasks[i].fixture == NULL || tasks[i].assembly == NULL)
+      error = 1;
+  }
+  if (!error && ntasks > 0)
+    tasks[ntasks - 1].fixture_len--;
+
+  fixture_fd = -1;
+  assembly_fd = -1;
+  if (!error) {
+    fixture_fd = open(fixture_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assembly_fd = open(assembly_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    error = fixture_fd < 0 || assembly_fd < 0;
+  }
+  for (int i = 0; i < ntasks && !error; i++) {
+    error = write_all(fixture_fd, tasks[i].fixture, tasks[i].fixture_len) ||
+            write_all(assembly_fd, tasks[i].assembly, tasks[i].assembly_len);
+  }
+  if (fixture_fd >= 0)
+    error |= close(fixture_fd) != 0;
+  if (assembly_fd >= 0)
+    error |= close(assembly_fd) != 0;
+  if (error)
+    printf("ERROR: corpus generation failed\n");
+
+  for (int i = 0; i < ntasks; i++) {
+    free(tasks[i].fixture);
+    free(tasks[i].assembly);
+  }
+
+  return (error);
+}
+
+/*
+ * Streaming disassembler for AArch64 images. ELF files are scanned over
+ * their executable sections, or executable PT_LOAD segments if section
+ * headers are stripped, anything else is a raw flat image loaded at 0.
+ * Only logical (immediate) and bitfield move instructions are printed,
+ * other words are skipped.
+ *
+ * Code ranges are cut into page-aligned chunks, workers format them into
+ * per-chunk buffers and the calling thread writes the buffers in chunk
+ * order. Workers run at most SCAN_WINDOW chunks ahead of the writer, so
+ * memory stays bounded for multi-GB images. Workers also ask the kernel
+ * to page in the chunk SCAN_READAHEAD ahead, which keeps several reads in
+ * flight on top of the sequential readahead of the mapping.
+ */
+#define SCAN_CHUNK_PAGES 64
+#define SCAN_WINDOW 64
+#define SCAN_READAHEAD 8
+#define SCAN_MAX_THREADS 64
+
+struct scan_chunk {
+  const uint8_t *start;
+  size_t size;
+  uint64_t vaddr;
+};
+
+struct scan_slot {
+  char *buf;
+  size_t len;
+  size_t cap;
+  bool done;
+};
+
+struct scan_state {
+  const struct scan_chunk *chunks;
+  size_t nchunks;
+  /* Next chunk to format and next chunk to write */
+  size_t next;
+  size_t written;
+  bool failed;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct scan_slot slots[SCAN_WINDOW];
+};
+
+static const char *const scan_logical_names[] = {"and", "orr", "eor", "ands"};
+
+static const char *const scan_bitfield_names[] = {
+    [ARM64_BITFIELD_ALIAS_ASR] = "asr",
+    [ARM64_BITFIELD_ALIAS_SBFIZ] = "sbfiz",
+    [ARM64_BITFIELD_ALIAS_SBFX] = "sbfx",
+    [ARM64_BITFIELD_ALIAS_SXTB] = "sxtb",
+    [ARM64_BITFIELD_ALIAS_SXTH] = "sxth",
+    [ARM64_BITFIELD_ALIAS_SXTW] = "sxtw",
+    [ARM64_BITFIELD_ALIAS_BFC] = "bfc",
+    [ARM64_BITFIELD_ALIAS_BFI] = "bfi",
+    [ARM64_BITFIELD_ALIAS_BFXIL] = "bfxil",
+    [ARM64_BITFIELD_ALIAS_LSL] = "lsl",
+    [ARM64_BITFIELD_ALIAS_LSR] = "lsr",
+    [ARM64_BITFIELD_ALIAS_UBFIZ] = "ubfiz",
+    [ARM64_BITFIELD_ALIAS_UBFX] = "ubfx",
+    [ARM64_BITFIELD_ALIAS_UXTB] = "uxtb",
+    [ARM64_BITFIELD_ALIAS_UXTH] = "uxth",
+};
+
+/* Register 31 is SP or ZR depending on the operand */
+static char *scan_format_reg(char *p, uint32_t sf, uint32_t reg, bool sp) {
+  if (reg == ARM64_REG_ZR && sp)
+    return (sf ? report_format_lit(p, "sp") : report_format_lit(p, "wsp"));
+  if (reg == ARM64_REG_ZR)
+    return (sf ? report_format_lit(p, "xzr") : report_format_lit(p, "wzr"));
+
+  *p++ = sf ? 'x' : 'w';
+  return (report_format_dec(p, reg));
+}
+
+static char *scan_format_imm(char *p, uint64_t value, bool hex) {
+  if (hex) {
+    p = report_format_lit(p, "#0x");
+    return (report_format_hex(p, value));
+  }
+
+  p = report_format_lit(p, "#");
+  return (report_format_dec(p, value));
+}
+
+static char *scan_format_logical(char *p,
+                                 const struct arm64_logical_imm_insn *d) {
+  switch (d->alias) {
+  case ARM64_LOGICAL_ALIAS_MOV:
+    p = report_format_lit(p, "mov\t");
+    p = scan_format_reg(p, d->sf, d->rd, true);
+    break;
+  case ARM64_LOGICAL_ALIAS_TST:
+    p = report_format_lit(p, "tst\t");
+    p = scan_format_reg(p, d->sf, d->rn, false);
+    break;
+  default:
+    p = report_format_str(p, scan_logical_names[d->op],
+                          strlen(scan_logical_names[d->op]));
+    p = report_format_lit(p, "\t");
+    /* ANDS sets flags, its Rd is ZR rather than SP */
+    p = scan_format_reg(p, d->sf, d->rd, d->op != ARM64_LOGICAL_ANDS);
+    p = report_format_lit(p, ", ");
+    p = scan_format_reg(p, d->sf, d->rn, false);
+    break;
+  }
+  p = report_format_lit(p, ", ");
+
+  return (scan_format_imm(p, d->imm, true));
+}
+
+static char *scan_format_bitfield(char *p,
+                                  const struct arm64_bitfield_insn *d) {
+  const char *name = scan_bitfield_names[d->alias];
+
+  p = report_format_str(p, name, strlen(name));
+  p = report_format_lit(p, "\t");
+  switch (d->alias) {
+  case ARM64_BITFIELD_ALIAS_SXTB:
+  case ARM64_BITFIELD_ALIAS_SXTH:
+  case ARM64_BITFIELD_ALIAS_SXTW:
+  case ARM64_BITFIELD_ALIAS_UXTB:
+  case ARM64_BITFIELD_ALIAS_UXTH:
+    /* Extensions always read a W register */
+    p = scan_format_reg(p, d->sf, d->rd, false);
+    p = report_format_lit(p, ", ");
+    return (scan_format_reg(p, 0, d->rn, false));
+  case ARM64_BITFIELD_ALIAS_BFC:
+    p = scan_format_reg(p, d->sf, d->rd, false);
+    break;
+  default:
+    p = scan_format_reg(p, d->sf, d->rd, false);
+    p = report_format_lit(p, ", ");
+    p = scan_format_reg(p, d->sf, d->rn, false);
+    break;
+  }
+  p = report_format_lit(p, ", ");
+  p = scan_format_imm(p, d->lsb, false);
+
+  switch (d->alias) {
+  case ARM64_BITFIELD_ALIAS_ASR:
+  case ARM64_BITFIELD_ALIAS_LSL:
+  case ARM64_BITFIELD_ALIAS_LSR:
+    return (p);
+  default:
+    p = report_format_lit(p, ", ");
+    return (scan_format_imm(p, d->width, false));
+  }
+}
+
+/*
+ * Appends "<vaddr>: <insn>\t<mnemonic>\t<operands>\n" at `p` if `insn` is
+ * a defined logical (immediate) or bitfield move, returns the new end.
+ * At most REPORT_LINE_MAX bytes are written.
+ */
+static char *scan_format_insn(char *p, uint64_t vaddr, uint32_t insn) {
+  struct arm64_logical_imm_insn logical;
+  struct arm64_bitfield_insn bitfield;
+  char *start = p;
+
+  /* Both classes are sf:opc:10010x, bit 23 is 0 */
+  if ((insn & 0x1e800000) != 0x12000000)
+    return (p);
+
+  p = report_format_hex(p, vaddr);
+  p = report_format_lit(p, ": ");
+  p = generate_format_digits(p, insn, 8, 4);
+  p = report_format_lit(p, "\t");
+  if (arm64_disasm_logical_imm(insn, &logical))
+    p = scan_format_logical(p, &logical);
+  else if (arm64_disasm_bitfield(insn, &bitfield))
+    p = scan_format_bitfield(p, &bitfield);
+  else
+    return (start);
+
+  return (report_format_lit(p, "\n"));
+}
+
+static uint32_t scan_read_insn(const uint8_t *p) {
+  /* Instructions are little-endian regardless of the host */
+  return (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+/* Returns false if the buffer couldn't grow */
+static bool scan_format_chunk(const struct scan_chunk *chunk,
+                              struct scan_slot *slot) {
+  char *buf;
+  size_t cap;
+
+  slot->len = 0;
+  for (size_t off = 0; off + 4 <= chunk->size; off += 4) {
+    if (slot->cap - slot->len < REPORT_LINE_MAX) {
+      cap = slot->cap == 0 ? REPORT_BLOCK_SIZE : slot->cap * 2;
+      buf = realloc(slot->buf, cap);
+      if (buf == NULL)
+        return (false);
+      slot->buf = buf;
+      slot->cap = cap;
+    }
+    slot->len = scan_format_insn(slot->buf + slot->len, chunk->vaddr + off,
+                                 scan_read_insn(chunk->start + off)) -
+                slot->buf;
+  }
+
+  return (true);
+}
+
+static void scan_willneed(const struct scan_chunk *chunk) {
+  uintptr_t start, page;
+
+  page = sysconf(_SC_PAGESIZE);
+  start = (uintptr_t)chunk->start & ~(page - 1);
+  madvise((void *)start, (uintptr_t)chunk->start + chunk->size - start,
+          MADV_WILLNEED);
+}
+
+static void *scan_worker(void *arg) {
+  struct scan_state *state = arg;
+  struct scan_slot *slot;
+  size_t i;
+  bool formatted;
+
+  pthread_mutex_lock(&state->lock);
+  for (;;) {
+    while (state->next < state->nchunks &&
+           state->next >= state->written + SCAN_WINDOW)
+      pthread_cond_wait(&state->cond, &state->lock);
+    if (state->next >= state->nchunks)
+      break;
+    i = state->next++;
+    pthread_mutex_unlock(&state->lock);
+
+    if (i + SCAN_READAHEAD < state->nchunks)
+      scan_willneed(&state->chunks[i + SCAN_READAHEAD]);
+
+    /* The slot was released by the writer, nobody else touches it */
+    slot = &state->slots[i % SCAN_WINDOW];
+    formatted = scan_format_chunk(&state->chunks[i], slot);
+
+    pthread_mutex_lock(&state->lock);
+    if (!formatted) {
+      state->failed = true;
+      slot->len = 0;
+    }
+    slot->done = true;
+    pthread_cond_broadcast(&state->cond);
+  }
+  pthread_mutex_unlock(&state->lock);
+
+  return (NULL);
+}
+
+/*
+ * Formats `chunks` with up to `nthreads` workers and writes the output to
+ * `out_fd` in chunk order. Returns 0 on success.
+ */
+static int scan_chunks(const struct scan_chunk *chunks, size_t nchunks,
+                       int out_fd, long nthreads) {
+  pthread_t threads[SCAN_MAX_THREADS];
+  struct scan_state *state;
+  struct scan_slot *slot;
+  int started, error;
+
+  state = calloc(1, sizeof(*state));
+  if (state == NULL)
+    return (-1);
+  state->chunks = chunks;
+  state->nchunks = nchunks;
+  pthread_mutex_init(&state->lock, NULL);
+  pthread_cond_init(&state->cond, NULL);
+
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > SCAN_MAX_THREADS)
+    nthreads = SCAN_MAX_THREADS;
+  for (started = 0; started < nthreads && (size_t)started < nchunks;
+       started++) {
+    if (pthread_create(&threads[started], NULL, scan_worker, state) != 0)
+      break;
+  }
+
+  error = 0;
+  for (size_t i = 0; i < nchunks; i++) {
+    slot = &state->slots[i % SCAN_WINDOW];
+    if (started == 0) {
+      /* No worker could start, format in place */
+      state->failed |= !scan_format_chunk(&chunks[i], slot);
+    } else {
+      pthread_mutex_lock(&state->lock);
+      while (!slot->done)
+        pthread_cond_wait(&state->cond, &state->lock);
+      pthread_mutex_unlock(&state->lock);
+    }
+
+    if (!error && !state->failed)
+      error = write_all(out_fd, slot->buf, slot->len);
+
+    pthread_mutex_lock(&state->lock);
+    slot->done = false;
+    state->written++;
+    pthread_cond_broadcast(&state->cond);
+    pthread_mutex_unlock(&state->lock);
+  }
+
+  for (int i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  if (state->failed)
+    error = -1;
+
+  for (int i = 0; i < SCAN_WINDOW; i++)
+    free(state->slots[i].buf);
+  pthread_cond_destroy(&state->cond);
+  pthread_mutex_destroy(&state->lock);
+  free(state);
+
+  return (error);
+}
+
+/*
+ * Appends chunks of the code range at `offset` of the image, boundaries
+ * are at page multiples of the file offset, moved down to a whole
+ * instruction if the range itself isn't instruction aligned.
+ */
+static void scan_add_range(const uint8_t *image, uint64_t offset,
+                           uint64_t size, uint64_t vaddr, size_t chunk_size,
+                           struct scan_chunk *chunks, size_t *nchunks) {
+  uint64_t start, end, next;
+
+  start = offset;
+  end = offset + size;
+  while (start < end) {
+    next = (start / chunk_size + 1) * chunk_size;
+    next -= (next - offset) & 3;
+    if (next > end || next <= start)
+      next = end;
+    chunks[*nchunks].start = image + start;
+    chunks[*nchunks].size = next - start;
+    chunks[*nchunks].vaddr = vaddr + (start - offset);
+    (*nchunks)++;
+    start = next;
+  }
+}
+
+/*
+ * Upper bound of chunks for `size` bytes of code cut at `chunk_size`
+ * boundaries, plus one partial chunk per range.
+ */
+static size_t scan_max_chunks(uint64_t size, size_t chunk_size,
+                              size_t ranges) {
+  return (size / chunk_size + 2 * ranges);
+}
+
+/*
+ * Builds the chunk list of `image`, returns a malloc()ed array or NULL if
+ * it is an ELF file which is truncated or not AArch64.
+ */
+static struct scan_chunk *scan_image_chunks(const uint8_t *image, size_t size,
+                                            size_t chunk_size,
+                                            size_t *nchunks) {
+  const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)image;
+  const Elf64_Shdr *shdr;
+  const Elf64_Phdr *phdr;
+  struct scan_chunk *chunks;
+  uint64_t total;
+  size_t ranges, max;
+
+  *nchunks = 0;
+  if (size < SELFMAG || memcmp(image, ELFMAG, SELFMAG) != 0) {
+    chunks = malloc(scan_max_chunks(size, chunk_size, 1) * sizeof(*chunks));
+    if (chunks != NULL)
+      scan_add_range(image, 0, size, 0, chunk_size, chunks, nchunks);
+    return (chunks);
+  }
+
+  if (size < sizeof(*ehdr) || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr->e_ident[EI_DATA] != ELFDATA2LSB || ehdr->e_machine != EM_AARCH64)
+    return (NULL);
+  if ((ehdr->e_shnum != 0 &&
+       (ehdr->e_shentsize != sizeof(*shdr) || ehdr->e_shoff > size ||
+        (size - ehdr->e_shoff) / sizeof(*shdr) < ehdr->e_shnum)) ||
+      (ehdr->e_phnum != 0 &&
+       (ehdr->e_phentsize != sizeof(*phdr) || ehdr->e_phoff > size ||
+        (size - ehdr->e_phoff) / sizeof(*phdr) < ehdr->e_phnum)))
+    return (NULL);
+
+  /* First pass validates ranges and sizes the chunk array */
+  shdr = (const Elf64_Shdr *)(image + ehdr->e_shoff);
+  phdr = (const Elf64_Phdr *)(image + ehdr->e_phoff);
+  total = 0;
+  ranges = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      /* Without code the list is empty, but not NULL like malloc(0) */
+      max = ranges == 0 ? 1 : scan_max_chunks(total, chunk_size, ranges);
+      chunks = malloc(max * sizeof(*chunks));
+      if (chunks == NULL)
+        return (NULL);
+    }
+    for (uint32_t i = 0; i < ehdr->e_shnum; i++) {
+      if (shdr[i].sh_type != SHT_PROGBITS ||
+          (shdr[i].sh_flags & SHF_EXECINSTR) == 0)
+        continue;
+      if (shdr[i].sh_offset > size ||
+          shdr[i].sh_size > size - shdr[i].sh_offset)
+        return (NULL);
+      if (pass == 0) {
+        total += shdr[i].sh_size;
+        ranges++;
+      } else {
+        scan_add_range(image, shdr[i].sh_offset, shdr[i].sh_size,
+                       shdr[i].sh_addr, chunk_size, chunks, nchunks);
+      }
+    }
+    /* Stripped files keep only segments */
+    for (uint32_t i = 0; ehdr->e_shnum == 0 && i < ehdr->e_phnum; i++) {
+      if (phdr[i].p_type != PT_LOAD || (phdr[i].p_flags & PF_X) == 0)
+        continue;
+      if (phdr[i].p_offset > size ||
+          phdr[i].p_filesz > size - phdr[i].p_offset)
+        return (NULL);
+      if (pass == 0) {
+        total += phdr[i].p_filesz;
+        ranges++;
+      } else {
+        scan_add_range(image, phdr[i].p_offset, phdr[i].p_filesz,
+                       phdr[i].p_vaddr, chunk_size, chunks, nchunks);
+      }
+    }
+  }
+
+  return (chunks);
+}
+
+/*
+ * Disassembles the image read from `fd` to `out_fd`, `chunk_size` must be
+ * a multiple of the page size.
+ */
+static int scan_fd(int fd, int out_fd, long nthreads, size_t chunk_size) {
+  struct scan_chunk *chunks;
+  struct stat sb;
+  size_t nchunks;
+  void *map;
+  int error;
+
+  if (fstat(fd, &sb) != 0) {
+    printf("fstat(): failed.");
+    return (1);
+  }
+  if (sb.st_size == 0)
+    return (0);
+
+  map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    printf("mmap(): failed.");
+    return (1);
+  }
+  madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+  error = 0;
+  chunks = scan_image_chunks(map, sb.st_size, chunk_size, &nchunks);
+  if (chunks == NULL) {
+    printf("ERROR: malformed or non-AArch64 ELF image\n");
+    error = 1;
+  } else if (scan_chunks(chunks, nchunks, out_fd, nthreads) != 0) {
+    printf("ERROR: disassembly output failed\n");
+    error = 1;
+  }
+
+  free(chunks);
+  munmap(map, sb.st_size);
+  return (error);
+}
+
+static int scan_file(const char *path, long nthreads) {
+  int fd, error;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("open(): failed.");
+    return (1);
+  }
+  error = scan_fd(fd, STDOUT_FILENO, nthreads,
+                  SCAN_CHUNK_PAGES * sysconf(_SC_PAGESIZE));
+  close(fd);
+
+  return (error);
+}
+
+/*
+ * Synthetic image for check_scan(): ELF header, one executable PT_LOAD
+ * for .text, .text itself, .rodata holding the same words without
+ * SHF_EXECINSTR, section names and section headers. Neither section size
+ * is a page multiple, so chunks end inside pages too.
+ */
+#define SCAN_CHECK_TEXT_OFFSET 0x1000
+#define SCAN_CHECK_TEXT_WORDS (5 * 4096 / 4 + 3)
+#define SCAN_CHECK_VADDR 0x400000
+
+static const char scan_check_names[] = "\0.text\0.rodata\0.shstrtab";
+
+static size_t scan_check_image(uint8_t *image, const uint32_t *words,
+                               bool stripped) {
+  Elf64_Ehdr *ehdr = (Elf64_Ehdr *)image;
+  Elf64_Phdr *phdr = (Elf64_Phdr *)(ehdr + 1);
+  Elf64_Shdr *shdr;
+  size_t text_size, rodata_offset, names_offset, size;
+
+  text_size = SCAN_CHECK_TEXT_WORDS * 4;
+  rodata_offset = SCAN_CHECK_TEXT_OFFSET + text_size;
+  names_offset = rodata_offset + text_size;
+  size = (names_offset + sizeof(scan_check_names) + 7) & ~(size_t)7;
+
+  memset(image, 0, SCAN_CHECK_TEXT_OFFSET);
+  memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+  ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr->e_type = ET_EXEC;
+  ehdr->e_machine = EM_AARCH64;
+  ehdr->e_version = EV_CURRENT;
+  ehdr->e_entry = SCAN_CHECK_VADDR + SCAN_CHECK_TEXT_OFFSET;
+  ehdr->e_phoff = sizeof(*ehdr);
+  ehdr->e_ehsize = sizeof(*ehdr);
+  ehdr->e_phentsize = sizeof(*phdr);
+  ehdr->e_phnum = 1;
+  ehdr->e_shentsize = sizeof(*shdr);
+
+  phdr->p_type = PT_LOAD;
+  phdr->p_flags = PF_R | PF_X;
+  phdr->p_offset = SCAN_CHECK_TEXT_OFFSET;
+  phdr->p_vaddr = SCAN_CHECK_VADDR + SCAN_CHECK_TEXT_OFFSET;
+  phdr->p_filesz = text_size;
+  phdr->p_memsz = text_size;
+
+  for (size_t i = 0; i < SCAN_CHECK_TEXT_WORDS; i++) {
+    for (int b = 0; b < 4; b++) {
+      image[SCAN_CHECK_TEXT_OFFSET + i * 4 + b] = words[i] >> (b * 8);
+      image[rodata_offset + i * 4 + b] = words[i] >> (b * 8);
+    }
+  }
+  memset(image + names_offset, 0, size - names_offset);
+  memcpy(image + names_offset, scan_check_names, sizeof(scan_check_names));
+  if (stripped)
+    return (size);
+
+  ehdr->e_shoff = size;
+  ehdr->e_shnum = 4;
+  ehdr->e_shstrndx = 3;
+  shdr = (Elf64_Shdr *)(image + size);
+  memset(shdr, 0, 4 * sizeof(*shdr));
+  shdr[1].sh_name = 1;
+  shdr[1].sh_type = SHT_PROGBITS;
+  shdr[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+  shdr[1].sh_addr = SCAN_CHECK_VADDR + SCAN_CHECK_TEXT_OFFSET;
+  shdr[1].sh_offset = SCAN_CHECK_TEXT_OFFSET;
+  shdr[1].sh_size = text_size;
+  shdr[2].sh_name = 7;
+  shdr[2].sh_type = SHT_PROGBITS;
+  shdr[2].sh_flags = SHF_ALLOC;
+  shdr[2].sh_addr = SCAN_CHECK_VADDR + rodata_offset;
+  shdr[2].sh_offset = rodata_offset;
+  shdr[2].sh_size = text_size;
+  shdr[3].sh_name = 15;
+  shdr[3].sh_type = SHT_STRTAB;
+  shdr[3].sh_offset = names_offset;
+  shdr[3].sh_size = sizeof(scan_check_names);
+
+  return (size + 4 * sizeof(*shdr));
+}
+
+/*
+ * Writes `size` bytes of `image` to a temporary file, scans it and
+ * compares the output with `expected`.
+ */
+static bool scan_check_run(const uint8_t *image, size_t size,
+                           const char *expected, size_t expected_len,
+                           long nthreads, size_t chunk_size) {
+  FILE *in, *out;
+  struct stat sb;
+  char *output;
+  bool match;
+
+  in = tmpfile();
+  out = tmpfile();
+  match = in != NULL && out != NULL &&
+          write_all(fileno(in), (const char *)image, size) == 0 &&
+          scan_fd(fileno(in), fileno(out), nthreads, chunk_size) == 0 &&
+          fstat(fileno(out), &sb) == 0 && (size_t)sb.st_size == expected_len;
+  if (match && expected_len > 0) {
+    output = malloc(expected_len);
+    match = output != NULL &&
+            pread(fileno(out), output, expected_len, 0) ==
+                (ssize_t)expected_len &&
+            memcmp(output, expected, expected_len) == 0;
+    free(output);
+  }
+
+  if (in != NULL)
+    fclose(in);
+  if (out != NULL)
+    fclose(out);
+  return (match);
+}
+
+/*
+ * Scans synthetic ELF files, a stripped one and a raw image with 1 and
+ * `nthreads` workers and page or default chunks. Output must equal a
+ * serial scan of .text words.
+ */
+static int check_scan(long nthreads) {
+  static const struct {
+    uint32_t insn;
+    const char *text;
+  } known[] = {
+      {0xb200f3e0, "mov\tx0, #0x5555555555555555\n"},
+      {0x531d7041, "lsl\tw1, w2, #3\n"},
+      {0x93407c20, "sxtw\tx0, w1\n"},
+      {0x33180fe0, "bfc\tw0, #8, #4\n"},
+      {0xb34057fc, "bfc\tx28, #0, #22\n"},
+  };
+  const size_t known_count = sizeof(known) / sizeof(known[0]);
+  uint32_t words[SCAN_CHECK_TEXT_WORDS];
+  char line[REPORT_LINE_MAX], *expected[2], *p;
+  size_t expected_len[2], size, page, chunk, nchunks, runs, lines;
+  long threads[2] = {1, nthreads};
+  struct scan_chunk *chunks;
+  int error;
+  uint64_t state, base;
+  uint8_t *image;
+
+  page = sysconf(_SC_PAGESIZE);
+
+  /* As printed by llvm-objdump, except MOV immediates are hex, not decimal */
+  for (size_t i = 0; i < known_count; i++) {
+    *scan_format_insn(line, 0, known[i].insn) = '\0';
+    if (strcmp(strchr(line, '\t') + 1, known[i].text) != 0) {
+      printf("ERROR: scan of %08x is not %s", known[i].insn, known[i].text);
+      return (1);
+    }
+  }
+
+  /* Known words first, then logical, bitfield, NOP and random words */
+  state = 0x9e3779b97f4a7c15ULL;
+  for (size_t i = 0; i < SCAN_CHECK_TEXT_WORDS; i++) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    words[i] = state >> 32;
+    if (i < known_count)
+      words[i] = known[i].insn;
+    else if (i % 4 == 0)
+      words[i] = (words[i] & ~0x1f800000) | ARM64_LOGICAL_IMM_VALUE;
+    else if (i % 4 == 1)
+      words[i] = (words[i] & ~0x1f800000) | ARM64_BITFIELD_VALUE;
+    else if (i % 4 == 2)
+      words[i] = 0xd503201f;
+  }
+
+  image = malloc(SCAN_CHECK_TEXT_OFFSET + SCAN_CHECK_TEXT_WORDS * 8 + page);
+  expected[0] = malloc(SCAN_CHECK_TEXT_WORDS * REPORT_LINE_MAX);
+  expected[1] = malloc(SCAN_CHECK_TEXT_WORDS * REPORT_LINE_MAX);
+  if (image == NULL || expected[0] == NULL || expected[1] == NULL) {
+    printf("malloc(): failed.");
+    exit(1);
+  }
+
+  /* ELF images load .text at its address, raw ones at 0 */
+  for (int k = 0; k < 2; k++) {
+    base = k == 0 ? SCAN_CHECK_VADDR + SCAN_CHECK_TEXT_OFFSET : 0;
+    p = expected[k];
+    for (size_t i = 0; i < SCAN_CHECK_TEXT_WORDS; i++)
+      p = scan_format_insn(p, base + i * 4, words[i]);
+    expected_len[k] = p - expected[k];
+  }
+
+  error = 1;
+  runs = 0;
+  for (int stripped = 0; stripped <= 1; stripped++) {
+    size = scan_check_image(image, words, stripped);
+    for (int t = 0; t < 2; t++) {
+      for (chunk = page; chunk <= SCAN_CHUNK_PAGES * page;
+           chunk *= SCAN_CHUNK_PAGES) {
+        runs += 2;
+        if (!scan_check_run(image, size, expected[0], expected_len[0],
+                            threads[t], chunk) ||
+            !scan_check_run(image + SCAN_CHECK_TEXT_OFFSET,
+                            SCAN_CHECK_TEXT_WORDS * 4, expected[1],
+                            expected_len[1], threads[t], chunk))
+          goto mismatch;
+      }
+    }
+  }
+
+  /* An ELF file without code scans to nothing */
+  ((Elf64_Phdr *)((Elf64_Ehdr *)image + 1))->p_flags = PF_R;
+  runs++;
+  if (!scan_check_run(image, size, NULL, 0, nthreads, page))
+    goto mismatch;
+
+  /* Other machines are rejected rather than scanned as raw */
+  ((Elf64_Ehdr *)image)->e_machine = EM_X86_64;
+  chunks = scan_image_chunks(image, size, page, &nchunks);
+  if (chunks != NULL) {
+    free(chunks);
+    goto mismatch;
+  }
+
+  lines = 0;
+  for (p = expected[0]; p < expected[0] + expected_len[0]; p++)
+    lines += *p == '\n';
+  printf("scan: runs: %zu, lines: %zu, mismatches: 0\n", runs, lines);
+  error = 0;
+
+mismatch:
+  if (error != 0)
+    printf("ERROR: scan mismatch stripped: %d chunk: %zu\n",
+           ((Elf64_Ehdr *)image)->e_shnum == 0, chunk);
+  free(image);
+  free(expected[0]);
+  free(expected[1]);
+  return (error);
+}
+
+/*
+ * Microbenchmarks, every primitive runs over the same input sets:
+ * - sequential: all immN:immr:imms values in order,
+ * - random: uniformly distributed immN:immr:imms values,
+ * - real: valid logical immediates biased to unrotated low masks
+ *   (0xff, 0xffff, 0xffffffff, ...), which dominate compiled code.
+ */
+#define BENCH_INPUTS (1 << 16)
+#define BENCH_ROUNDS 64
+
+struct bench_input {
+  uint64_t value;
+  uint32_t n;
+  uint32_t immr;
+  uint32_t imms;
+  uint32_t esize;
+  uint32_t sf;
+};
+
+typedef uint64_t (*bench_fn)(const struct bench_input *in, size_t count);
+
+static uint64_t bench_random_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t bench_random(void) {
+  /* xorshift64 */
+  bench_random_state ^= bench_random_state << 13;
+  bench_random_state ^= bench_random_state >> 7;
+  bench_random_state ^= bench_random_state << 17;
+
+  return (bench_random_state);
+}
+
+static void bench_input_fill(struct bench_input *in, uint32_t index) {
+  uint64_t wmask;
+  int length;
+
+  in->n = (index >> 12) & 0x1;
+  in->immr = (index >> 6) & 0x3F;
+  in->imms = index & 0x3F;
+  in->sf = in->n == 1 || (index & 0x1);
+
+  length = arm64_highest_set_bit((in->n << 6) | (~in->imms & 0x3F));
+  in->esize = length < 1 ? 2 : 1 << length;
+  if (!arm64_disasm_bit_masks(in->n, in->imms, in->immr, false, &wmask))
+    wmask = index;
+  in->value = wmask;
+}
+
+static void bench_inputs_init(struct bench_input *sequential,
+                              struct bench_input *random,
+                              struct bench_input *real) {
+  uint32_t valid[ARM64_BIT_MASKS_TABLE_SIZE];
+  uint32_t count, low, i;
+  uint64_t wmask;
+
+  count = 0;
+  for (i = 0; i < ARM64_BIT_MASKS_TABLE_SIZE; i++) {
+    if (arm64_disasm_bit_masks(i >> 12, i & 0x3F, (i >> 6) & 0x3F, true,
+                               &wmask))
+      valid[count++] = i;
+  }
+
+  /* Unrotated masks first, so half of real inputs come from them */
+  low = 0;
+  for (i = 0; i < count; i++) {
+    if (((valid[i] >> 6) & 0x3F) == 0) {
+      uint32_t tmp = valid[low];
+      valid[low++] = valid[i];
+      valid[i] = tmp;
+    }
+  }
+
+  for (i = 0; i < BENCH_INPUTS; i++) {
+    bench_input_fill(&sequential[i], i % ARM64_BIT_MASKS_TABLE_SIZE);
+    bench_input_fill(&random[i], bench_random() % ARM64_BIT_MASKS_TABLE_SIZE);
+    if (bench_random() & 0x1)
+      bench_input_fill(&real[i], valid[bench_random() % low]);
+    else
+      bench_input_fill(&real[i], valid[bench_random() % count]);
+  }
+}
+
+static uint64_t bench_highest_set_bit(const struct bench_input *in,
+                                      size_t count) {
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    sum += arm64_highest_set_bit((in[i].n << 6) | (~in[i].imms & 0x3F));
+
+  return (sum);
+}
+
+static uint64_t bench_flsl(const struct bench_input *in, size_t count) {
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    sum += flsl((in[i].n << 6) | (~in[i].imms & 0x3F)) - 1;
+
+  return (sum);
+}
+
+static uint64_t bench_replicate(const struct bench_input *in, size_t count) {
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    sum += arm64_replicate(in[i].value & arm64_ones(in[i].esize),
+                           in[i].esize, sizeof(uint64_t) * CHAR_BIT);
+
+  return (sum);
+}
+
+static uint64_t bench_ror(const struct bench_input *in, size_t count) {
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    sum += arm64_ror(in[i].value & arm64_ones(in[i].esize),
+                     in[i].immr & (in[i].esize - 1), in[i].esize);
+
+  return (sum);
+}
+
+static uint64_t bench_disasm_bit_masks(const struct bench_input *in,
+                                       size_t count) {
+  uint64_t sum = 0, wmask = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (arm64_disasm_bit_masks(in[i].n, in[i].imms, in[i].immr, true, &wmask))
+      sum += wmask;
+  }
+
+  return (sum);
+}
+
+static uint64_t bench_disasm_bit_masks_table(const struct bench_input *in,
+                                             size_t count) {
+  uint64_t sum = 0, wmask = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (arm64_disasm_bit_masks_table(in[i].n, in[i].imms, in[i].immr, true,
+                                     &wmask))
+      sum += wmask;
+  }
+
+  return (sum);
+}
+
+/* N=1 inputs are rejected, like W register instructions would do */
+static uint64_t bench_kern_disasm_bit_masks(const struct bench_input *in,
+                                            size_t count) {
+  uint64_t sum = 0, wmask = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (arm64_kern_disasm_bit_masks(in[i].n, in[i].imms, in[i].immr, true, 64,
+                                    &wmask))
+      sum += wmask;
+  }
+
+  return (sum);
+}
+
+static uint64_t bench_disasm_bit_masks32(const struct bench_input *in,
+                                         size_t count) {
+  uint64_t sum = 0;
+  uint32_t wmask = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (arm64_disasm_bit_masks32(in[i].n, in[i].imms, in[i].immr, true,
+                                 &wmask))
+      sum += wmask;
+  }
+
+  return (sum);
+}
+
+static uint64_t bench_disasm_bit_masks32_table(const struct bench_input *in,
+                                               size_t count) {
+  uint64_t sum = 0;
+  uint32_t wmask = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (arm64_disasm_bit_masks32_table(in[i].n, in[i].imms, in[i].immr, true,
+                                       &wmask))
+      sum += wmask;
+  }
+
+  return (sum);
+}
+
+static uint64_t bench_encode_bit_masks(const struct bench_input *in,
+                                       size_t count) {
+  uint64_t sum = 0;
+  uint32_t n, immr, imms;
+
+  for (size_t i = 0; i < count; i++) {
+    if (arm64_encode_bit_masks(in[i].value, &n, &immr, &imms))
+      sum += n + immr + imms;
+  }
+
+  return (sum);
+}
+
+static uint64_t bench_is_bitmask_imm(const struct bench_input *in,
+                                     size_t count) {
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    sum += arm64_is_bitmask_imm(in[i].value, 64);
+
+  return (sum);
+}
+
+/* Values are copied into a small pool first, like a constant pool */
+static uint64_t bench_is_bitmask_imm_batch(const struct bench_input *in,
+                                           size_t count) {
+  uint64_t pool[256], sum = 0;
+  uint8_t valid[256];
+  size_t i, j, n;
+
+  for (i = 0; i < count; i += n) {
+    n = count - i < 256 ? count - i : 256;
+    for (j = 0; j < n; j++)
+      pool[j] = in[i + j].value;
+    arm64_is_bitmask_imm_batch(pool, n, valid, 64);
+    for (j = 0; j < n; j++)
+      sum += valid[j];
+  }
+
+  return (sum);
+}
+
+static uint64_t bench_move_wide_preferred(const struct bench_input *in,
+                                          size_t count) {
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    sum += arm64_move_wide_preferred(in[i].sf, in[i].n, in[i].imms,
+                                     in[i].immr);
+
+  return (sum);
+}
+
+static uint64_t bench_move_wide_preferred_table(const struct bench_input *in,
+                                                size_t count) {
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    sum += arm64_move_wide_preferred_table(in[i].sf, in[i].n, in[i].imms,
+                                           in[i].immr);
+
+  return (sum);
+}
+
+/* X register SBFM, BFM and UBFM in turn, immN = 1 like sf */
+static uint32_t bench_bitfield_insn(const struct bench_input *in, size_t i) {
+  return (ARM64_BITFIELD_VALUE | 1U << 31 | (uint32_t)(i % 3) << 29 |
+          1U << 22 | in[i].immr << 16 | in[i].imms << 10);
+}
+
+static uint64_t bench_bitfield_alias(const struct bench_input *in,
+                                     size_t count) {
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    sum += arm64_bitfield_alias(1, i % 3, in[i].imms, in[i].immr);
+
+  return (sum);
+}
+
+static uint64_t bench_disasm_bitfield(const struct bench_input *in,
+                                      size_t count) {
+  struct arm64_bitfield_insn decoded;
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    if (arm64_disasm_bitfield(bench_bitfield_insn(in, i), &decoded))
+      sum += decoded.alias + decoded.wmask + decoded.tmask;
+  }
+
+  return (sum);
+}
+
+static uint64_t bench_plan_constant(const struct bench_input *in,
+                                    size_t count) {
+  struct arm64_constant_plan plan;
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    sum += arm64_plan_constant(in[i].value, 0, &plan) + plan.insns[0];
+
+  return (sum);
+}
+
+static uint64_t bench_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ * Runs every primitive over every input set and prints results as JSON.
+ */
+static void run_benchmarks(void) {
+  static struct bench_input inputs[3][BENCH_INPUTS];
+  static const char *input_names[] = {"sequential", "random", "real"};
+  static const struct {
+    const char *name;
+    bench_fn fn;
+  } benches[] = {
+      {"arm64_highest_set_bit", bench_highest_set_bit},
+      {"flsl", bench_flsl},
+      {"arm64_replicate", bench_replicate},
+      {"arm64_ror", bench_ror},
+      {"arm64_disasm_bit_masks", bench_disasm_bit_masks},
+      {"arm64_disasm_bit_masks_table", bench_disasm_bit_masks_table},
+      {"arm64_kern_disasm_bit_masks", bench_kern_disasm_bit_masks},
+      {"arm64_disasm_bit_masks32", bench_disasm_bit_masks32},
+      {"arm64_disasm_bit_masks32_table", bench_disasm_bit_masks32_table},
+      {"arm64_encode_bit_masks", bench_encode_bit_masks},
+      {"arm64_is_bitmask_imm", bench_is_bitmask_imm},
+      {"arm64_is_bitmask_imm_batch", bench_is_bitmask_imm_batch},
+      {"arm64_move_wide_preferred", bench_move_wide_preferred},
+      {"arm64_move_wide_preferred_table", bench_move_wide_preferred_table},
+      {"arm64_bitfield_alias", bench_bitfield_alias},
+      {"arm64_disasm_bitfield", bench_disasm_bitfield},
+      {"arm64_plan_constant", bench_plan_constant},
+  };
+  volatile uint64_t sink;
+  uint64_t start, elapsed, ops;
+  size_t b, k;
+  int round;
+
+  bench_inputs_init(inputs[0], inputs[1], inputs[2]);
+
+  printf("{\n  \"rounds\": %d,\n  \"inputs\": %d,\n  \"benchmarks\": [",
+         BENCH_ROUNDS, BENCH_INPUTS);
+  for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+    for (k = 0; k < 3; k++) {
+      /* Warm up caches and branch predictors */
+      sink = benches[b].fn(inputs[k], BENCH_INPUTS);
+
+      start = bench_now_ns();
+      for (round = 0; round < BENCH_ROUNDS; round++)
+        sink += benches[b].fn(inputs[k], BENCH_INPUTS);
+      elapsed = bench_now_ns() - start;
+      ops = (uint64_t)BENCH_ROUNDS * BENCH_INPUTS;
+
+      printf("%s\n    {\"name\": \"%s\", \"input\": \"%s\", \"ops\": %lu, "
+             "\"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}",
+             b == 0 && k == 0 ? "" : ",", benches[b].name, input_names[k],
+             ops, (double)elapsed / ops,
+             elapsed == 0 ? 0.0 : ops * 1e9 / elapsed);
+    }
+  }
+  printf("\n  ]\n}\n");
+  (void)sink;
+}
+
+int main(int argc, char **argv) {
+  struct arm64_fixture_record *records = NULL;
+  const struct arm64_fixture_record *mapped, *embedded;
+  const char *binary_fixture = NULL;
+  const char *convert_to = NULL;
+  const char *generate_dir = NULL;
+  const char *scan_path = NULL;
+  const char *text_fixture = NULL;
+  char fixture_path[PATH_MAX], assembly_path[PATH_MAX];
+  uint64_t count = 0;
+  uint32_t datasize = 64, mapped_datasize;
+  size_t map_size;
+  long nthreads;
+  int opt, error;
+  bool exhaustive = false, scan_check = false;
+
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((opt = getopt(argc, argv, "BDF:SW:abcd:ef:g:i:j:mstx:")) != -1) {
+    switch (opt) {
+    case 'B':
+      run_benchmarks();
+      return 0;
+    case 'D':
+      scan_check = true;
+      break;
+    case 'F':
+      text_fixture = optarg;
+      break;
+    case 'S':
+#if defined(ARM64_BITMASK_STATS)
+      /* Runs after report_atexit(), which is registered later */
+      atexit(arm64_stats_atexit);
+      break;
+#else
+      fprintf(stderr, "%s: built without ARM64_BITMASK_STATS\n", argv[0]);
+      return 1;
+#endif
+    case 'W':
+      datasize = strtoul(optarg, NULL, 10);
+      if (datasize != 32 && datasize != 64) {
+        fprintf(stderr, "%s: -W takes 32 or 64\n", argv[0]);
+        return 1;
+      }
+      break;
+    case 'a':
+      return check_bitfield();
+    case 'b':
+      check_batch_decode();
+      check_batch_validity();
+      return 0;
+    case 'd':
+      scan_path = optarg;
+      break;
+    case 'c':
+      check_variants();
+      return 0;
+    case 'e':
+      exhaustive = true;
+      break;
+    case 'f':
+      binary_fixture = optarg;
+      break;
+    case 'g':
+      generate_dir = optarg;
+      break;
+    case 'i':
+      if (strcmp(optarg, "pread") == 0)
+        input_backend = INPUT_PREAD;
+      else if (strcmp(optarg, "uring") == 0)
+        input_backend = INPUT_URING;
+      else {
+        fprintf(stderr, "%s: -i takes pread or uring\n", argv[0]);
+        return 1;
+      }
+      break;
+    case 'j':
+      nthreads = strtol(optarg, NULL, 10);
+      break;
+    case 'm':
+      return check_constant_plans();
+    case 's':
+      return check_sve_bitmask();
+    case 't':
+      arm64_bit_masks_decode = arm64_disasm_bit_masks_table;
+      arm64_bit_masks32_decode = arm64_disasm_bit_masks32_table;
+      break;
+    case 'x':
+      convert_to = optarg;
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-B | -D | -a | -b | -c | -e | -m | -s | -t] [-S] "
+              "[-W 32 | 64] [-i pread | uring] [-j threads] [-F fixture.txt] "
+              "[-f fixture.bin | -x out.bin | -g dir | -d image]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  if (scan_check)
+    return check_scan(nthreads);
+  if (scan_path != NULL)
+    return scan_file(scan_path, nthreads);
+
+  /* ERROR paths exit(), report is flushed before stdio output then */
+  if (report_init(&report, STDOUT_FILENO) != 0) {
+    printf("malloc(): failed.");
+    return 1;
+  }
+  atexit(report_atexit);
+
+  if (exhaustive)
+    return run_exhaustive(nthreads);
+
+  if (generate_dir != NULL) {
+    snprintf(fixture_path, sizeof(fixture_path), "%s/%s", generate_dir,
+             datasize == 32 ? "all_possible_bitmask_imm32.txt"
+                            : "all_possible_bitmask_imm.txt");
+    snprintf(assembly_path, sizeof(assembly_path), "%s/%s", generate_dir,
+             datasize == 32 ? "generate32.txt" : "generate.txt");
+    return generate_corpus(fixture_path, assembly_path, datasize, nthreads);
+  }
+
+  if (binary_fixture != NULL) {
+    mapped = map_binary_fixture(binary_fixture, &count, &mapped_datasize,
+                                &map_size);
+    if (mapped == NULL)
+      return 1;
+    check_fixture_records(mapped, count, mapped_datasize);
+    munmap((void *)((const struct arm64_fixture_header *)mapped - 1),
+           map_size);
+    return 0;
+  }
+
+  if (text_fixture == NULL) {
+    if (datasize == 32) {
+      embedded = arm64_fixture_embedded32;
+      count = ARM64_NITEMS(arm64_fixture_embedded32);
+    } else {
+      embedded = arm64_fixture_embedded64;
+      count = ARM64_NITEMS(arm64_fixture_embedded64);
+    }
+    if (convert_to != NULL)
+      return write_binary_fixture(convert_to, embedded, count, datasize);
+    check_fixture_records(embedded, count, datasize);
+    return 0;
+  }
+
+  if (convert_to == NULL)
+    return run_fixture_pipeline(text_fixture, datasize);
+
+  records = read_text_fixture(text_fixture, datasize, nthreads, &count);
+  if (records == NULL)
+    return 1;
 
-  return 0;
+  error = write_binary_fixture(convert_to, records, count, datasize);
+  free(records);
+  return error;
 }